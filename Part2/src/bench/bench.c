@@ -0,0 +1,216 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server/operations.h"
+
+#define CONTENTION_CALLS 20000     // Reservations made by each thread of the contention benchmark
+#define CONTENTION_ROWS 100        // Rows of the event, each thread reserves its own column
+#define CONTENTION_MAX_THREADS 16  // Threads of the largest run of the contention benchmark
+#define LOOKUP_CALLS 20000         // Reservations made for each number of events of the lookup benchmark
+#define LOOKUP_STRIDE 7919         // Prime step between the events looked up, so they are spread over all of them
+#define VALIDATE_CALLS 200         // Largest number of reservations made on each event of the validation benchmark
+#define VALIDATE_SEATS 4           // Seats of each reservation of the validation benchmark
+
+/// Thread of the contention benchmark.
+typedef struct ContentionThread {
+  pthread_t thread;
+  size_t col;  // Column of the event the thread reserves
+} ContentionThread_t;
+
+/// Prints the benchmark's command line syntax.
+/// @param program Name of the benchmark executable.
+static void print_usage(const char* program) { fprintf(stderr, "Usage: %s [contention|lookup|validate]\n", program); }
+
+/// Computes the time elapsed since the given instant.
+/// @param start Instant on the monotonic clock.
+/// @return Elapsed time in nanoseconds.
+static double elapsed_ns(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) * 1e9 + (double)(now.tv_nsec - start->tv_nsec);
+}
+
+/// Main function of the threads of the contention benchmark. Reserves every seat of the thread's column one by one,
+/// then keeps reserving them again, which fails.
+/// @param args Thread argument. A `ContentionThread_t` struct is passed as argument.
+/// @return `NULL`
+static void* reserve_column(void* args) {
+  ContentionThread_t* thread = (ContentionThread_t*)args;
+
+  for (size_t i = 0; i < CONTENTION_CALLS; i++) {
+    size_t row = i % CONTENTION_ROWS + 1, col = thread->col;
+    ems_reserve(1, 1, &row, &col);
+  }
+  return NULL;
+}
+
+/// Runs the contention benchmark once.
+/// @param mode Reservation mode of the server.
+/// @param thread_count Number of threads reserving on the event.
+/// @return Average time of a reservation in nanoseconds, negative on error.
+static double run_contention(enum ReserveMode mode, size_t thread_count) {
+  ContentionThread_t threads[CONTENTION_MAX_THREADS];
+
+  if (ems_init(0, mode) || ems_create(1, CONTENTION_ROWS, thread_count)) return -1;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < thread_count; i++) {
+    threads[i].col = i + 1;
+    if (pthread_create(&threads[i].thread, NULL, reserve_column, &threads[i]) != 0) {
+      printf("Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < thread_count; i++) pthread_join(threads[i].thread, NULL);
+  double call_ns = elapsed_ns(&start) / (double)(thread_count * CONTENTION_CALLS);
+
+  // Every seat is reserved once, so the ids must be 1 to the number of seats
+  SeatSnapshot_t* snapshot;
+  if (ems_show(1, &snapshot)) return -1;
+  unsigned int max_id = 0;
+  for (size_t i = 0; i < CONTENTION_ROWS * thread_count; i++) {
+    if (snapshot->seats[i] > max_id) max_id = snapshot->seats[i];
+  }
+  ems_release_snapshot(snapshot);
+
+  if (ems_terminate() || max_id != CONTENTION_ROWS * thread_count) return -1;
+  return call_ns;
+}
+
+/// Measures reservations made by many threads at once on a single event, in each reservation mode.
+/// Each thread reserves its own column and then fails to reserve it again, so the threads mostly contend on
+/// the event rather than on its seats.
+/// @return 0 if successful, 1 otherwise.
+static int bench_contention(void) {
+  const size_t thread_counts[] = {1, 4, 8, 16};
+
+  printf("contention: ns per reservation, %d per thread\n", CONTENTION_CALLS);
+  printf("%8s %9s %9s %9s\n", "threads", "mutex", "cas", "combine");
+  for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+    double mutex_ns = run_contention(RESERVE_MUTEX, thread_counts[i]);
+    double cas_ns = run_contention(RESERVE_CAS, thread_counts[i]);
+    double combine_ns = run_contention(RESERVE_COMBINE, thread_counts[i]);
+    if (mutex_ns < 0 || cas_ns < 0 || combine_ns < 0) {
+      printf("Contention benchmark failed\n");
+      return 1;
+    }
+    printf("%8zu %9.0f %9.0f %9.0f\n", thread_counts[i], mutex_ns, cas_ns, combine_ns);
+  }
+  return 0;
+}
+
+/// Measures how long finding an event takes as the number of events grows. Every event has a single seat and the
+/// reservations made ask for a seat outside it, so they fail right after finding their event.
+/// @note Operations sleep for the access delay even when it is 0, which takes about 50us with the default timer
+/// slack. That would hide the lookup and make creating a million events take minutes, so the slack is lowered meanwhile.
+/// @return 0 if successful, 1 otherwise.
+static int bench_lookup(void) {
+  const size_t event_counts[] = {10, 10000, 1000000};
+
+  int timer_slack = prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+  if (timer_slack < 0 || prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) < 0) {
+    perror("Failed to set the timer slack");
+    return 1;
+  }
+
+  printf("lookup: ns per reservation, %d per number of events\n", LOOKUP_CALLS);
+  printf("%8s %9s\n", "events", "ns");
+  for (size_t i = 0; i < sizeof(event_counts) / sizeof(event_counts[0]); i++) {
+    size_t row = 2, col = 1;
+    int status = ems_init(0, RESERVE_MUTEX);
+    for (unsigned int event_id = 1; !status && event_id <= event_counts[i]; event_id++)
+      status = ems_create(event_id, 1, 1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t call = 0; !status && call < LOOKUP_CALLS; call++)
+      status = ems_reserve((unsigned int)(call * LOOKUP_STRIDE % event_counts[i]) + 1, 1, &row, &col) == 0;
+    double call_ns = elapsed_ns(&start) / LOOKUP_CALLS;
+
+    if (ems_terminate() || status) {
+      prctl(PR_SET_TIMERSLACK, (unsigned long)timer_slack, 0UL, 0UL, 0UL);
+      printf("Lookup benchmark failed\n");
+      return 1;
+    }
+    printf("%8zu %9.0f\n", event_counts[i], call_ns);
+  }
+  prctl(PR_SET_TIMERSLACK, (unsigned long)timer_slack, 0UL, 0UL, 0UL);
+  return 0;
+}
+
+/// Measures how long reserving takes as the events grow. Each reservation takes the next free seats of the event
+/// in row order, so they all succeed.
+/// @return 0 if successful, 1 otherwise.
+static int bench_validate(void) {
+  const size_t sides[] = {32, 256, 1024};
+
+  printf("validate: ns per reservation of %d seats, up to %d per event\n", VALIDATE_SEATS, VALIDATE_CALLS);
+  printf("%8s %9s\n", "seats", "ns");
+  for (size_t i = 0; i < sizeof(sides) / sizeof(sides[0]); i++) {
+    size_t num_seats = sides[i] * sides[i];
+    size_t calls = num_seats / VALIDATE_SEATS < VALIDATE_CALLS ? num_seats / VALIDATE_SEATS : VALIDATE_CALLS;
+    int status = ems_init(0, RESERVE_MUTEX) || ems_create(1, sides[i], sides[i]);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t call = 0; !status && call < calls; call++) {
+      size_t xs[VALIDATE_SEATS], ys[VALIDATE_SEATS];
+      for (size_t j = 0; j < VALIDATE_SEATS; j++) {
+        size_t seat = call * VALIDATE_SEATS + j;
+        xs[j] = seat / sides[i] + 1;
+        ys[j] = seat % sides[i] + 1;
+      }
+      status = ems_reserve(1, VALIDATE_SEATS, xs, ys);
+    }
+    double call_ns = elapsed_ns(&start) / (double)calls;
+
+    if (ems_terminate() || status) {
+      printf("Validation benchmark failed\n");
+      return 1;
+    }
+    printf("%8zu %9.0f\n", num_seats, call_ns);
+  }
+  return 0;
+}
+
+/// Benchmark that can be picked on the command line.
+typedef struct Benchmark {
+  const char* name;
+  int (*run)(void);  // Returns 0 if successful, 1 otherwise
+} Benchmark_t;
+
+static const Benchmark_t benchmarks[] = {
+    {"contention", bench_contention}, {"lookup", bench_lookup}, {"validate", bench_validate}};
+
+int main(int argc, char* argv[]) {
+  const size_t benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  size_t picked = benchmark_count;  // Every benchmark if none is picked
+  for (size_t i = 0; argc == 2 && i < benchmark_count; i++) {
+    if (strcmp(argv[1], benchmarks[i].name) == 0) picked = i;
+  }
+  if (argc > 2 || (argc == 2 && picked == benchmark_count)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Failed reservations are reported on stderr, which would take longer than the reservations themselves
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0 || dup2(null_fd, STDERR_FILENO) < 0) {
+    perror("Failed to silence stderr");
+    return 1;
+  }
+  close(null_fd);
+
+  int status = 0;
+  for (size_t i = 0; i < benchmark_count; i++) {
+    if (picked == benchmark_count || picked == i) status |= benchmarks[i].run();
+  }
+  return status;
+}
@@ -1,26 +1,390 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "common/constants.h"
 #include "common/io.h"
+#include "common/ring.h"
 #include "api.h"
 
-static ConnectionPipes_t pipes;
+#define REQUEST_MAX_BUFFERS 3  // Maximum number of buffers a request is sent from
 
-int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+#define NO_REQUEST MAX_IN_FLIGHT  // End of the list of completed requests
+
+enum RequestState { REQUEST_FREE, REQUEST_WAITING, REQUEST_DONE };
+
+/// What to do with the response to a request.
+typedef struct ResponseHandler {
+  char op;
+  int out_fd;                // File descriptor the response of a SHOW or LIST is printed to
+  SharedChannel_t* channel;  // Channel the connection moves to if an OP_SHM request succeeds
+  uint32_t* version;         // Where the version in the response to a conditional SHOW or LIST is stored
+  EmsSeatMap_t* seat_map;    // Copy of the seats updated by the response to a SHOW_SINCE
+  size_t* first_seat;        // Where the row and column of the first seat of a RESERVE_BEST are stored, may be NULL
+  EmsStats_t* stats;         // Where the counts in the response to a STATS are stored
+  int run_length;            // Whether the seats of a SHOW response may be sent as runs of equal seats
+  EmsCallback_t callback;    // Called by `ems_dispatch`, `NULL` if the response is waited for with `ems_receive`
+  void* ctx;
+} ResponseHandler_t;
+
+/// Request that was sent and is waiting for its response.
+typedef struct PendingRequest {
+  uint32_t id;
+  enum RequestState state;
+  ResponseHandler_t handler;
+  char* response;  // Response without its frame, once `state` is `REQUEST_DONE`. `NULL` if the connection broke
+  size_t response_size;
+  size_t next_completed;  // Next request in the list of completed requests with a callback
+  pthread_cond_t done;    // Signaled when `state` becomes `REQUEST_DONE` or the connection breaks
+} PendingRequest_t;
+
+/// Reservation of a watched event pushed by the server, waiting for `ems_dispatch`.
+typedef struct PushedReservation {
+  struct PushedReservation* next;  // Reservation pushed after this one
+  size_t size;                     // Size of `push`
+  char push[];                     // Push without its frame
+} PushedReservation_t;
+
+struct EmsConnection {
+  char req_pipe[MAX_PIPE_NAME_SIZE];
+  char resp_pipe[MAX_PIPE_NAME_SIZE];
+  int req_fd;
+  int resp_fd;
+  int is_socket;             // Whether both fds are the same Unix domain socket instead of named pipes
+  unsigned int version;      // Protocol version spoken with the server
+  SharedChannel_t* channel;  // Shared memory carrying requests and responses, `NULL` if not attached
+
+  pthread_mutex_t send_lock;  // Held while a request is written, so requests are never interleaved
+  uint32_t next_request_id;   // Id of the next request to be sent, protected by `send_lock`
+
+  pthread_mutex_t pending_lock;  // Protects `pending` and `broken`
+  pthread_cond_t slot_freed;     // Signaled when a request of `pending` is received
+  int broken;                    // Whether responses stopped arriving, because of an error or the server leaving
+  PendingRequest_t pending[MAX_IN_FLIGHT];  // Indexed by request id modulo `MAX_IN_FLIGHT`
+  size_t completed_head;                    // Completed requests with a callback, oldest first
+  size_t completed_tail;
+  int completion_fd;                  // Eventfd that is readable while `completed_head` or `pushes_head` is not empty
+  EmsWatchCallback_t watch_callback;  // Called for each pushed reservation, protected by `pending_lock`
+  void* watch_ctx;
+  PushedReservation_t* pushes_head;  // Pushed reservations waiting for `ems_dispatch`, oldest first
+  PushedReservation_t* pushes_tail;
+
+  pthread_t reader;  // Receives every response and hands it to its request in `pending`
+  int reader_started;
+  size_t inbox_start;  // Position of the first byte in `inbox` that was not taken yet
+  size_t inbox_end;    // Number of bytes in `inbox`
+  char inbox[CLIENT_INBOX_SIZE];
+};
+
+/// Sends a whole request to the server with a single write, or through shared memory if it is attached.
+/// @note The caller must hold `send_lock`.
+/// @param connection Connection to the server.
+/// @param request_id Id the request is tagged with.
+/// @param iov Array of buffers holding the request.
+/// @param iovcnt Number of buffers, at most `REQUEST_MAX_BUFFERS`.
+/// @return Same as `safe_writev`.
+static ssize_t send_request(EmsConnection_t* connection, uint32_t request_id, const struct iovec* iov, int iovcnt) {
+  struct iovec frame[REQUEST_MAX_BUFFERS + 2];
+  uint32_t length = REQUEST_ID_SIZE;
+  int frame_count = 0;
+
+  frame[frame_count++] = (struct iovec){.iov_base = &length, .iov_len = FRAME_HEADER_SIZE};
+  frame[frame_count++] = (struct iovec){.iov_base = &request_id, .iov_len = REQUEST_ID_SIZE};
+  for (int i = 0; i < iovcnt; i++) {
+    length += (uint32_t)iov[i].iov_len;
+    frame[frame_count++] = iov[i];
+  }
+
+  if (connection->channel == NULL) return safe_writev(connection->req_fd, frame, frame_count);
+
+  ssize_t completed_bytes = 0;
+  for (int i = 0; i < frame_count; i++) {
+    if (ring_write(&connection->channel->requests, frame[i].iov_base, frame[i].iov_len, connection->resp_fd) < 0)
+      return -1;
+    completed_bytes += (ssize_t)frame[i].iov_len;
+  }
+  return completed_bytes;
+}
+
+/// Receives exactly nbytes from the server, through shared memory if it is attached.
+/// @param connection Connection to the server.
+/// @param buf Buffer to hold the received data.
+/// @param nbytes Amount of data to receive.
+/// @return Same as `safe_read`.
+static ssize_t receive_exactly(EmsConnection_t* connection, void* buf, size_t nbytes) {
+  if (connection->channel != NULL)
+    return ring_read(&connection->channel->responses, buf, nbytes, connection->resp_fd);
+  return safe_read(connection->resp_fd, buf, nbytes);
+}
+
+/// Receives what the server has sent, waiting for at least one byte.
+/// @param connection Connection to the server.
+/// @param buf Buffer to hold the received data.
+/// @param nbytes Maximum amount of data to receive.
+/// @return Same as the read() syscall.
+static ssize_t receive_some(EmsConnection_t* connection, void* buf, size_t nbytes) {
+  if (connection->channel != NULL)
+    return ring_read_some(&connection->channel->responses, buf, nbytes, connection->resp_fd);
+
+  ssize_t rd_bytes;
+  do {
+    rd_bytes = read(connection->resp_fd, buf, nbytes);
+  } while (rd_bytes < 0 && errno == EINTR);
+  return rd_bytes;
+}
+
+/// Takes bytes from what was received from the server, receiving more when needed. Small responses
+/// are received whole in one read, larger ones go straight to the caller's buffer.
+/// @param connection Connection to the server.
+/// @param buf Buffer to hold the data.
+/// @param nbytes Amount of data to take.
+/// @return 0 if successful, 1 otherwise.
+static int read_inbox(EmsConnection_t* connection, void* buf, size_t nbytes) {
+  size_t buffered = connection->inbox_end - connection->inbox_start;
+  size_t taken = buffered < nbytes ? buffered : nbytes;
+
+  memcpy(buf, connection->inbox + connection->inbox_start, taken);
+  connection->inbox_start += taken;
+  if (taken == nbytes) return 0;
+
+  // The inbox is empty from here on
+  size_t missing = nbytes - taken;
+  connection->inbox_start = connection->inbox_end = 0;
+  if (missing >= CLIENT_INBOX_SIZE)
+    return receive_exactly(connection, (char*)buf + taken, missing) != (ssize_t)missing;
+
+  while (connection->inbox_end < missing) {
+    ssize_t rd_bytes =
+        receive_some(connection, connection->inbox + connection->inbox_end, CLIENT_INBOX_SIZE - connection->inbox_end);
+    if (rd_bytes <= 0) return 1;
+    connection->inbox_end += (size_t)rd_bytes;
+  }
+
+  memcpy((char*)buf + taken, connection->inbox, missing);
+  connection->inbox_start = missing;
+  return 0;
+}
+
+/// Stores the response of a request and tells whoever waits for it.
+/// @note The caller must hold `pending_lock`.
+/// @param connection Connection to the server.
+/// @param request Request waiting for a response.
+/// @param response Response without its frame, `NULL` if the connection broke.
+/// @param response_size Size of the response.
+static void complete_request(EmsConnection_t* connection, PendingRequest_t* request, char* response,
+                             size_t response_size) {
+  request->response = response;
+  request->response_size = response_size;
+  request->state = REQUEST_DONE;
+
+  if (request->handler.callback == NULL) {
+    pthread_cond_signal(&request->done);
+    return;
+  }
+
+  size_t index = (size_t)(request - connection->pending);
+  request->next_completed = NO_REQUEST;
+  if (connection->completed_head == NO_REQUEST) {
+    connection->completed_head = index;
+
+    // Only the first completion is signaled, `ems_dispatch` takes every completed request at once
+    uint64_t signal = 1;
+    if (write(connection->completion_fd, &signal, sizeof(signal)) < 0) perror("Could not signal completion");
+  } else {
+    connection->pending[connection->completed_tail].next_completed = index;
+  }
+  connection->completed_tail = index;
+}
+
+/// Receives a reservation pushed by the server and queues it for `ems_dispatch`.
+/// @param connection Connection to the server.
+/// @param push_size Size of the push without its frame.
+/// @return 0 if successful, 1 if no more responses can be received.
+static int receive_push(EmsConnection_t* connection, size_t push_size) {
+  PushedReservation_t* push = malloc(sizeof(PushedReservation_t) + push_size);
+  if (push == NULL) {
+    fprintf(stderr, "Could not allocate memory for response\n");
+    return 1;
+  }
+  if (read_inbox(connection, push->push, push_size)) {
+    free(push);
+    return 1;
+  }
+  push->size = push_size;
+  push->next = NULL;
+
+  pthread_mutex_lock(&connection->pending_lock);
+  if (connection->pushes_head == NULL) {
+    connection->pushes_head = push;
+
+    uint64_t signal = 1;
+    if (write(connection->completion_fd, &signal, sizeof(signal)) < 0) perror("Could not signal completion");
+  } else {
+    connection->pushes_tail->next = push;
+  }
+  connection->pushes_tail = push;
+  pthread_mutex_unlock(&connection->pending_lock);
+  return 0;
+}
+
+/// Receives the next response frame and hands it to the request with its id.
+/// @param connection Connection to the server.
+/// @return 0 if successful, 1 if no more responses can be received.
+static int dispatch_response(EmsConnection_t* connection) {
+  uint32_t header[2];  // Contains length, request_id
+
+  if (read_inbox(connection, header, sizeof(header))) return 1;
+  if (header[0] < REQUEST_ID_SIZE + sizeof(int)) {
+    fprintf(stderr, "Response is shorter than expected\n");
+    return 1;
+  }
+
+  size_t response_size = header[0] - REQUEST_ID_SIZE;
+  if (header[1] == PUSH_REQUEST_ID) return receive_push(connection, response_size);
+  char* response = malloc(response_size);
+  if (response == NULL) {
+    fprintf(stderr, "Could not allocate memory for response\n");
+    return 1;
+  }
+  if (read_inbox(connection, response, response_size)) {
+    free(response);
+    return 1;
+  }
+
+  pthread_mutex_lock(&connection->pending_lock);
+  PendingRequest_t* request = &connection->pending[header[1] % MAX_IN_FLIGHT];
+  if (request->state != REQUEST_WAITING || request->id != header[1]) {
+    pthread_mutex_unlock(&connection->pending_lock);
+    fprintf(stderr, "Response does not match any request\n");
+    free(response);
+    return 1;
+  }
+
+  // The server answers OP_SHM through the pipes and sends everything after it through the channel
+  int status;
+  memcpy(&status, response + response_size - sizeof(int), sizeof(int));
+  if (request->handler.op == OP_SHM && status == 0) connection->channel = request->handler.channel;
+
+  complete_request(connection, request, response, response_size);
+  pthread_mutex_unlock(&connection->pending_lock);
+  return 0;
+}
+
+/// Reader thread of a connection. Receives responses until the server is gone, then wakes up every waiting thread.
+/// @param args Connection to the server.
+/// @return NULL.
+static void* read_responses(void* args) {
+  EmsConnection_t* connection = (EmsConnection_t*)args;
+
+  while (dispatch_response(connection) == 0) continue;
+
+  pthread_mutex_lock(&connection->pending_lock);
+  connection->broken = 1;
+  for (size_t i = 0; i < MAX_IN_FLIGHT; i++) {
+    PendingRequest_t* request = &connection->pending[i];
+    if (request->state == REQUEST_WAITING && request->handler.callback != NULL)
+      complete_request(connection, request, NULL, 0);
+    else
+      pthread_cond_broadcast(&request->done);
+  }
+  pthread_cond_broadcast(&connection->slot_freed);
+  pthread_mutex_unlock(&connection->pending_lock);
+
+  return NULL;
+}
+
+/// Reads the server's reply to a setup request.
+/// @param connection Connection to store the protocol version in.
+/// @param fd File descriptor the reply is read from.
+/// @return 0 if successful, 1 otherwise.
+static int read_setup_reply(EmsConnection_t* connection, int fd) {
+  unsigned int reply[2];  // Contains session_id, version
+
+  if (safe_read(fd, reply, sizeof(reply)) != sizeof(reply)) {
+    perror("Could not get the session ID");
+    return 1;
+  }
+
+  // Responses are told apart by their request id, so older protocols cannot share the session between threads
+  if (reply[1] < PROTOCOL_TAGGED) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_TAGGED);
+    return 1;
+  }
+  connection->version = reply[1];
+  printf("Server connection established. **SESSION_ID = %u**\n", reply[0]);
+
+  return 0;
+}
+
+/// Connects to an EMS server listening on a Unix domain socket.
+/// @param connection Connection to store the socket in.
+/// @param socket_path Path to the server's socket.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+static int socket_setup(EmsConnection_t* connection, char const* socket_path) {
+  char request_buff[SETUP_REQUEST_BUFSIZ] = {0};
+  struct sockaddr_un address;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, socket_path);
+
+  int server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server_socket < 0) {
+    perror("Could not create socket");
+    return 1;
+  }
+  connection->req_fd = connection->resp_fd = server_socket;
+
+  if (connect(server_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    perror("Could not connect to server socket");
+    return 1;
+  }
+
+  *request_buff = (char)OP_SETUP;
+  request_buff[SETUP_VERSION_OFFSET] = PROTOCOL_VERSION;
+  if (safe_write(server_socket, request_buff, SETUP_REQUEST_BUFSIZ) < 0) {
+    perror("Could not write to server socket");
+    return 1;
+  }
+
+  if (read_setup_reply(connection, server_socket)) return 1;
+
+  return 0;
+}
+
+/// Connects to an EMS server through named pipes.
+/// @param connection Connection to store the pipes in.
+/// @param req_pipe_path Path to the name pipe to be created for requests.
+/// @param resp_pipe_path Path to the name pipe to be created for responses.
+/// @param server_pipe_path Path to the name pipe where the server is listening.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+static int pipe_setup(EmsConnection_t* connection, char const* req_pipe_path, char const* resp_pipe_path,
+                      char const* server_pipe_path) {
   char request_buff[SETUP_REQUEST_BUFSIZ] = {0};
-  unsigned int session_id;
 
   *request_buff = (char)OP_SETUP;
   strcpy(request_buff + sizeof(char), req_pipe_path);
   strcpy(request_buff + sizeof(char) * (MAX_PIPE_NAME_SIZE + 1), resp_pipe_path);
+  request_buff[SETUP_VERSION_OFFSET] = PROTOCOL_VERSION;
 
-  strncpy(pipes.req_pipe, req_pipe_path, MAX_PIPE_NAME_SIZE);
-  strncpy(pipes.resp_pipe, resp_pipe_path, MAX_PIPE_NAME_SIZE);
+  strncpy(connection->req_pipe, req_pipe_path, MAX_PIPE_NAME_SIZE);
+  strncpy(connection->resp_pipe, resp_pipe_path, MAX_PIPE_NAME_SIZE);
 
   if (mkfifo(req_pipe_path, 0640)) {
     perror("Could not create response pipe");
@@ -50,236 +414,1040 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
     perror("Could not open response pipe");
     return 1;
   }
-  pipes.resp_fd = resp_pipe;
+  connection->resp_fd = resp_pipe;
 
-  if (safe_read(resp_pipe, &session_id, sizeof(int)) < 0) {
-    perror("Could not get the session ID");
-    close(resp_pipe);
-    return 1;
-  }
-  printf("Server connection established. **SESSION_ID = %u**\n", session_id);
+  if (read_setup_reply(connection, resp_pipe)) return 1;
 
   int req_pipe = open(req_pipe_path, O_WRONLY);
   if (req_pipe < 0) {
     perror("Could not open request pipe");
-    close(resp_pipe);
     return 1;
   }
-  pipes.req_fd = req_pipe;
+  connection->req_fd = req_pipe;
 
   return 0;
 }
 
-int close_pipes(void) {
-  close(pipes.req_fd);
-  close(pipes.resp_fd);
+/// Closes and unlinks the pipes of a connection, then frees it.
+/// @param connection Connection to the server, whose reader thread is not running.
+/// @return 0 if successful, 1 otherwise.
+static int close_connection(EmsConnection_t* connection) {
+  int return_value = 0;
+
+  if (connection->channel != NULL) close_channel(connection->channel);
 
-  if (unlink(pipes.req_pipe) < 0) {
+  if (connection->req_fd >= 0) close(connection->req_fd);
+  if (!connection->is_socket && connection->resp_fd >= 0) close(connection->resp_fd);
+
+  if (!connection->is_socket && *connection->req_pipe && unlink(connection->req_pipe) < 0) {
     perror("Failed to unlink request pipe");
-    return 1;
+    return_value = 1;
   }
-
-  if (unlink(pipes.resp_pipe) < 0) {
+  if (!connection->is_socket && *connection->resp_pipe && unlink(connection->resp_pipe) < 0) {
     perror("Failed to unlink response pipe");
-    return 1;
+    return_value = 1;
   }
-  return 0;
-}
 
-int ems_quit(void) {
-  char op = (char)OP_QUIT;
+  if (connection->completion_fd >= 0) close(connection->completion_fd);
 
-  if (safe_write(pipes.req_fd, &op, sizeof(char)) < 0) {
-    perror("Could not send quit request");
-    return 1;
+  while (connection->pushes_head != NULL) {
+    PushedReservation_t* push = connection->pushes_head;
+    connection->pushes_head = push->next;
+    free(push);
   }
 
-  close_pipes();
-  return 0;
+  for (size_t i = 0; i < MAX_IN_FLIGHT; i++) {
+    free(connection->pending[i].response);
+    pthread_cond_destroy(&connection->pending[i].done);
+  }
+  pthread_cond_destroy(&connection->slot_freed);
+  pthread_mutex_destroy(&connection->pending_lock);
+  pthread_mutex_destroy(&connection->send_lock);
+  free(connection);
+
+  return return_value;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  char op = (char)OP_CREATE;
-  int return_value = 1;
-  size_t num_matrix[] = {num_rows, num_cols};
+EmsConnection_t* ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
+  struct stat server_stat;
 
-  if (safe_write(pipes.req_fd, &op, sizeof(char)) < 0) {
-    perror("Could not send operation code");
-    return 1;
+  EmsConnection_t* connection = calloc(1, sizeof(EmsConnection_t));
+  if (connection == NULL) {
+    fprintf(stderr, "Could not allocate memory for connection\n");
+    return NULL;
+  }
+
+  connection->req_fd = connection->resp_fd = -1;
+  connection->completed_head = connection->completed_tail = NO_REQUEST;
+  connection->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pthread_mutex_init(&connection->send_lock, NULL);
+  pthread_mutex_init(&connection->pending_lock, NULL);
+  pthread_cond_init(&connection->slot_freed, NULL);
+  for (size_t i = 0; i < MAX_IN_FLIGHT; i++) pthread_cond_init(&connection->pending[i].done, NULL);
+
+  connection->is_socket = stat(server_pipe_path, &server_stat) == 0 && S_ISSOCK(server_stat.st_mode);
+  if (connection->completion_fd < 0) {
+    perror("Could not create completion eventfd");
+    close_connection(connection);
+    return NULL;
+  }
+
+  int setup_status = connection->is_socket ? socket_setup(connection, server_pipe_path)
+                                           : pipe_setup(connection, req_pipe_path, resp_pipe_path, server_pipe_path);
+  if (setup_status) {
+    close_connection(connection);
+    return NULL;
   }
-  if (safe_write(pipes.req_fd, &event_id, sizeof(int)) < 0) {
-    perror("Could not send creation information");
+
+  if (pthread_create(&connection->reader, NULL, read_responses, (void*)connection) != 0) {
+    fprintf(stderr, "Failed to dispatch reader thread\n");
+    close_connection(connection);
+    return NULL;
+  }
+  connection->reader_started = 1;
+
+  return connection;
+}
+
+/// Claims the slot of the next request id and sends the request.
+/// @note The caller must hold `send_lock`.
+/// @param connection Connection to the server.
+/// @note A request with a callback does not wait for its slot, which may only be freed by the caller's `ems_dispatch`.
+/// @param handler What to do with the response.
+/// @param iov Array of buffers holding the request.
+/// @param iovcnt Number of buffers, at most `REQUEST_MAX_BUFFERS`.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise, with `errno` set to `EAGAIN` if the slot of a request
+/// with a callback was busy.
+static int send_pending_request(EmsConnection_t* connection, ResponseHandler_t handler, const struct iovec* iov,
+                                int iovcnt, uint32_t* request_id) {
+  uint32_t id = connection->next_request_id;
+  PendingRequest_t* request = &connection->pending[id % MAX_IN_FLIGHT];
+
+  // The slot must be claimed before sending, the response may arrive before `send_request` returns
+  pthread_mutex_lock(&connection->pending_lock);
+  while (request->state != REQUEST_FREE && !connection->broken && handler.callback == NULL)
+    pthread_cond_wait(&connection->slot_freed, &connection->pending_lock);
+
+  if (connection->broken) {
+    pthread_mutex_unlock(&connection->pending_lock);
+    fprintf(stderr, "Connection to the server was lost\n");
     return 1;
   }
-  if (safe_write(pipes.req_fd, num_matrix, 2 * sizeof(size_t)) < 0) {
-    perror("Could not send creation information");
+
+  if (request->state != REQUEST_FREE) {
+    pthread_mutex_unlock(&connection->pending_lock);
+    errno = EAGAIN;
     return 1;
   }
 
-  if (safe_read(pipes.resp_fd, &return_value, sizeof(int)) <= 0) {
-    perror("Could not read return value of operation");
+  request->id = id;
+  request->state = REQUEST_WAITING;
+  request->handler = handler;
+  pthread_mutex_unlock(&connection->pending_lock);
+
+  if (send_request(connection, id, iov, iovcnt) < 0) {
+    perror("Could not send request");
+
+    pthread_mutex_lock(&connection->pending_lock);
+    request->state = REQUEST_FREE;
+    pthread_cond_broadcast(&connection->slot_freed);
+    pthread_mutex_unlock(&connection->pending_lock);
     return 1;
   }
 
+  // Pushes are told apart from responses by their id, so no request gets it
+  if (++connection->next_request_id == PUSH_REQUEST_ID) connection->next_request_id = 0;
+  *request_id = id;
+  return 0;
+}
+
+/// Sends a request and remembers it until its response is received.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response.
+/// @param iov Array of buffers holding the request.
+/// @param iovcnt Number of buffers, at most `REQUEST_MAX_BUFFERS`.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int submit_request(EmsConnection_t* connection, ResponseHandler_t handler, const struct iovec* iov, int iovcnt,
+                          uint32_t* request_id) {
+  pthread_mutex_lock(&connection->send_lock);
+  int return_value = send_pending_request(connection, handler, iov, iovcnt, request_id);
+  pthread_mutex_unlock(&connection->send_lock);
+
   return return_value;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  char op = (char)OP_RESERVE;
+/// Waits for the response to a request and frees its slot.
+/// @param connection Connection to the server.
+/// @param request_id Id of the request.
+/// @param handler Pointer to store what to do with the response in.
+/// @param response_size Pointer to store the size of the response in.
+/// @return Response without its frame, to be freed by the caller, `NULL` if it could not be received.
+static char* wait_response(EmsConnection_t* connection, uint32_t request_id, ResponseHandler_t* handler,
+                           size_t* response_size) {
+  PendingRequest_t* request = &connection->pending[request_id % MAX_IN_FLIGHT];
+
+  pthread_mutex_lock(&connection->pending_lock);
+  if (request->state == REQUEST_FREE || request->id != request_id || request->handler.callback != NULL) {
+    pthread_mutex_unlock(&connection->pending_lock);
+    fprintf(stderr, "No request is waiting with that id\n");
+    return NULL;
+  }
+
+  while (request->state != REQUEST_DONE && !connection->broken)
+    pthread_cond_wait(&request->done, &connection->pending_lock);
+
+  char* response = request->response;
+  *handler = request->handler;
+  *response_size = request->response_size;
+
+  request->response = NULL;
+  request->state = REQUEST_FREE;
+  pthread_cond_broadcast(&connection->slot_freed);
+  pthread_mutex_unlock(&connection->pending_lock);
+
+  if (response == NULL) fprintf(stderr, "Connection to the server was lost\n");
+  return response;
+}
+
+int ems_attach_shared_memory(EmsConnection_t* connection) {
+  static atomic_uint channel_count = 0;
+  char request_buff[sizeof(char) + MAX_PIPE_NAME_SIZE] = {0};
+  char* shm_name = request_buff + sizeof(char);
   int return_value = 1;
 
-  if (safe_write(pipes.req_fd, &op, sizeof(char)) < 0) {
-    perror("Could not send operation code");
-    return 1;
+  snprintf(shm_name, MAX_PIPE_NAME_SIZE, "/ems_%d_%u", getpid(), atomic_fetch_add(&channel_count, 1));
+  SharedChannel_t* channel = create_channel(shm_name);
+  if (channel == NULL) return 1;
+
+  // Nothing may be sent until the reader has moved to the channel, so the send lock is held until then
+  pthread_mutex_lock(&connection->send_lock);
+  *request_buff = (char)OP_SHM;
+  struct iovec request[] = {{.iov_base = request_buff, .iov_len = sizeof(request_buff)}};
+  uint32_t request_id;
+  if (connection->channel == NULL &&
+      send_pending_request(connection, (ResponseHandler_t){.op = OP_SHM, .out_fd = -1, .channel = channel}, request, 1,
+                           &request_id) == 0) {
+    ResponseHandler_t handler;
+    size_t response_size;
+    char* response = wait_response(connection, request_id, &handler, &response_size);
+
+    if (response != NULL) memcpy(&return_value, response + response_size - sizeof(int), sizeof(int));
+    free(response);
   }
-  if (safe_write(pipes.req_fd, &event_id, sizeof(int)) < 0) {
-    perror("Could not send reservation information");
-    return 1;
+  pthread_mutex_unlock(&connection->send_lock);
+
+  // Once the server has mapped it (or refused it), the name is no longer needed
+  shm_unlink(shm_name);
+  if (return_value) {
+    fprintf(stderr, "Could not attach shared memory\n");
+    close_channel(channel);
+    return return_value;
   }
-  if (safe_write(pipes.req_fd, &num_seats, sizeof(size_t)) < 0) {
-    perror("Could not send reservation information");
-    return 1;
+
+  return 0;
+}
+
+int ems_quit(EmsConnection_t* connection) {
+  char op = (char)OP_QUIT;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)}};
+  int return_value = 0;
+
+  pthread_mutex_lock(&connection->send_lock);
+  if (send_request(connection, connection->next_request_id, request, 1) < 0) {
+    perror("Could not send quit request");
+    return_value = 1;
   }
-  if (safe_write(pipes.req_fd, xs, sizeof(size_t) * MAX_RESERVATION_SIZE) < 0) {
-    perror("Could not send reservation information");
-    return 1;
+  pthread_mutex_unlock(&connection->send_lock);
+
+  // The server closes its end once it quits, which stops the reader. If the request was not sent,
+  // the connection is already broken or the reader must be woken up by closing it
+  if (return_value) shutdown(connection->resp_fd, SHUT_RDWR);
+  if (connection->reader_started) pthread_join(connection->reader, NULL);
+
+  if (close_connection(connection)) return 1;
+  return return_value;
+}
+
+/// Sends a request to create a new event.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_create(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id, size_t num_rows,
+                       size_t num_cols, uint32_t* request_id) {
+  char op = handler.op = (char)OP_CREATE;
+  size_t num_matrix[] = {num_rows, num_cols};
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = num_matrix, .iov_len = 2 * sizeof(size_t)}};
+
+  return submit_request(connection, handler, request, 3, request_id);
+}
+
+/// Encodes a reservation request in the `PROTOCOL_COMPACT` format: event id, number of seats
+/// and a (row, column) pair per seat, as 32-bit integers.
+/// @param request Buffer to encode the request in, with room for `MAX_RESERVATION_SIZE` seats.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return Size of the request, 0 if it cannot be encoded.
+static size_t encode_compact_reserve(char* request, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  uint32_t header[2] = {event_id, (uint32_t)num_seats};
+
+  if (num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Too many seats in one reservation\n");
+    return 0;
   }
-  if (safe_write(pipes.req_fd, ys, sizeof(size_t) * MAX_RESERVATION_SIZE) < 0) {
-    perror("Could not send reservation information");
-    return 1;
+
+  *request = (char)OP_RESERVE;
+  memcpy(request + sizeof(char), header, sizeof(header));
+
+  char* seat_pairs = request + sizeof(char) + sizeof(header);
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] > UINT32_MAX || ys[i] > UINT32_MAX) {
+      fprintf(stderr, "Seat out of bounds\n");
+      return 0;
+    }
+
+    uint32_t seat[2] = {(uint32_t)xs[i], (uint32_t)ys[i]};
+    memcpy(seat_pairs + i * sizeof(seat), seat, sizeof(seat));
   }
 
-  if (safe_read(pipes.resp_fd, &return_value, sizeof(int)) <= 0) {
-    perror("Could not read return value of operation");
+  return sizeof(char) + sizeof(header) + num_seats * 2 * sizeof(uint32_t);
+}
+
+/// Sends a request to create a new reservation.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_reserve(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id, size_t num_seats,
+                        size_t* xs, size_t* ys, uint32_t* request_id) {
+  char compact_request[sizeof(char) + 2 * sizeof(uint32_t) * (MAX_RESERVATION_SIZE + 1)];
+  size_t request_size = encode_compact_reserve(compact_request, event_id, num_seats, xs, ys);
+  if (request_size == 0) return 1;
+
+  struct iovec request[] = {{.iov_base = compact_request, .iov_len = request_size}};
+  handler.op = (char)OP_RESERVE;
+  return submit_request(connection, handler, request, 1, request_id);
+}
+
+/// Sends a request to reserve adjacent seats wherever they are free.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_reserve_best(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id,
+                             size_t num_seats, uint32_t* request_id) {
+  if (connection->version < PROTOCOL_BEST) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_BEST);
+    return 1;
+  }
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Invalid number of seats\n");
     return 1;
   }
 
-  return return_value;
+  char op = handler.op = (char)OP_RESERVE_BEST;
+  uint32_t compact_num_seats = (uint32_t)num_seats;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = &compact_num_seats, .iov_len = sizeof(uint32_t)}};
+
+  return submit_request(connection, handler, request, 3, request_id);
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-  char op = (char)OP_SHOW;
-  int return_value = 1;
-  size_t num_matrix[2];  // Contains num_rows, num_cols
+/// Sends a request to show an event.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param event_id Id of the event to print.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_show(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id,
+                     uint32_t* request_id) {
+  char op = handler.op = (char)OP_SHOW;
+  handler.run_length = connection->version >= PROTOCOL_RUN_LENGTH;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)}};
 
-  if (safe_write(pipes.req_fd, &op, sizeof(char)) < 0) {
-    perror("Could not send operation code");
+  return submit_request(connection, handler, request, 2, request_id);
+}
+
+/// Sends a request to show a section of an event.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param event_id Id of the event to print.
+/// @param range First and last row, then first and last column of the section, starting at 1.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_show_range(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id,
+                           const size_t* range, uint32_t* request_id) {
+  if (connection->version < PROTOCOL_RANGE) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_RANGE);
     return 1;
   }
-  if (safe_write(pipes.req_fd, &event_id, sizeof(int)) < 0) {
-    perror("Could not send show operation information");
+
+  uint32_t compact_range[4];
+  for (size_t i = 0; i < 4; i++) {
+    if (range[i] > UINT32_MAX) {
+      fprintf(stderr, "Range out of bounds\n");
+      return 1;
+    }
+    compact_range[i] = (uint32_t)range[i];
+  }
+
+  char op = handler.op = (char)OP_SHOW_RANGE;
+  handler.run_length = 1;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = compact_range, .iov_len = sizeof(compact_range)}};
+
+  return submit_request(connection, handler, request, 3, request_id);
+}
+
+/// Sends a request to list the events.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, its operation code is set here.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_list_events(EmsConnection_t* connection, ResponseHandler_t handler, uint32_t* request_id) {
+  char op = handler.op = (char)OP_LIST;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)}};
+
+  return submit_request(connection, handler, request, 1, request_id);
+}
+
+/// Checks that the server answers conditional SHOW and LIST requests.
+/// @param connection Connection to the server.
+/// @return 0 if it does, 1 otherwise.
+static int check_conditional(const EmsConnection_t* connection) {
+  if (connection->version >= PROTOCOL_CONDITIONAL) return 0;
+
+  fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_CONDITIONAL);
+  return 1;
+}
+
+/// Sends a request to show an event if it changed since the version the handler points to.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, with its version set. Its operation code is set here.
+/// @param event_id Id of the event to print.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_show_if_changed(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id,
+                                uint32_t* request_id) {
+  if (check_conditional(connection)) return 1;
+
+  char op = handler.op = (char)OP_SHOW_IF_CHANGED;
+  handler.run_length = connection->version >= PROTOCOL_RUN_LENGTH;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = handler.version, .iov_len = sizeof(uint32_t)}};
+
+  return submit_request(connection, handler, request, 3, request_id);
+}
+
+/// Sends a request to list the events if they changed since the version the handler points to.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, with its version set. Its operation code is set here.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_list_events_if_changed(EmsConnection_t* connection, ResponseHandler_t handler, uint32_t* request_id) {
+  if (check_conditional(connection)) return 1;
+
+  char op = handler.op = (char)OP_LIST_IF_CHANGED;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = handler.version, .iov_len = sizeof(uint32_t)}};
+
+  return submit_request(connection, handler, request, 2, request_id);
+}
+
+/// Sends a request for the seats of an event reserved since the last update of the handler's seat map.
+/// @param connection Connection to the server.
+/// @param handler What to do with the response, with its seat map set. Its operation code is set here.
+/// @param event_id Id of the event.
+/// @param request_id Pointer to store the id of the request in.
+/// @return Same as `send_pending_request`.
+static int send_show_since(EmsConnection_t* connection, ResponseHandler_t handler, unsigned int event_id,
+                           uint32_t* request_id) {
+  if (connection->version < PROTOCOL_DELTA) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_DELTA);
     return 1;
   }
 
-  if (safe_read(pipes.resp_fd, &num_matrix, 2 * sizeof(size_t)) <= 0) {
-    perror("Could not get show operation information");
+  // A map that was never updated needs every reserved seat
+  uint32_t since = handler.seat_map->seats != NULL ? handler.seat_map->reservations : 0;
+  char op = handler.op = (char)OP_SHOW_SINCE;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = &since, .iov_len = sizeof(uint32_t)}};
+
+  return submit_request(connection, handler, request, 3, request_id);
+}
+
+int ems_send_create(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols,
+                    uint32_t* request_id) {
+  return send_create(connection, (ResponseHandler_t){.out_fd = -1}, event_id, num_rows, num_cols, request_id);
+}
+
+int ems_send_reserve(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys,
+                     uint32_t* request_id) {
+  return send_reserve(connection, (ResponseHandler_t){.out_fd = -1}, event_id, num_seats, xs, ys, request_id);
+}
+
+int ems_send_reserve_best(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, uint32_t* request_id) {
+  return send_reserve_best(connection, (ResponseHandler_t){.out_fd = -1}, event_id, num_seats, request_id);
+}
+
+int ems_send_show(EmsConnection_t* connection, int out_fd, unsigned int event_id, uint32_t* request_id) {
+  return send_show(connection, (ResponseHandler_t){.out_fd = out_fd}, event_id, request_id);
+}
+
+int ems_send_list_events(EmsConnection_t* connection, int out_fd, uint32_t* request_id) {
+  return send_list_events(connection, (ResponseHandler_t){.out_fd = out_fd}, request_id);
+}
+
+/// Prints a seat of a SHOW response, followed by a space, or by a newline if it ends its row.
+/// @param out_fd File descriptor to print the seat to.
+/// @param seat Reservation id of the seat.
+/// @param ends_row Whether the seat is the last of its row.
+/// @return 0 if successful, 1 otherwise.
+static int print_seat(int out_fd, unsigned int seat, int ends_row) {
+  char buffer[16];
+  sprintf(buffer, "%u", seat);
+
+  if (print_str(out_fd, buffer) || print_str(out_fd, ends_row ? "\n" : " ")) {
+    perror("Error writing to file descriptor");
     return 1;
   }
+  return 0;
+}
 
+/// Prints the seats of a SHOW response sent as runs of equal seats.
+/// @param out_fd File descriptor to print the event to.
+/// @param num_matrix Number of rows and columns of the event.
+/// @param runs Runs of the response, after their number.
+/// @param num_runs Number of runs.
+/// @return 0 if successful, 1 otherwise.
+static int print_runs(int out_fd, const size_t* num_matrix, const char* runs, size_t num_runs) {
   size_t num_seats = num_matrix[0] * num_matrix[1];
-  unsigned int* seats = (unsigned int*)malloc(sizeof(int) * num_seats);
-  if (seats == NULL) {
-    fprintf(stderr, "Could not allocate memory for seats.\n");
-    return 1;
+
+  // Every run must fit in the event before anything is printed
+  size_t covered = 0;
+  for (size_t i = 0; i < num_runs && covered <= num_seats; i++) {
+    uint32_t run[2];  // Contains length, reservation id
+    memcpy(run, runs + i * sizeof(run), sizeof(run));
+    covered += run[0];
   }
-  if (safe_read(pipes.resp_fd, seats, sizeof(int) * num_seats) < 0) {
-    perror("Could not get seats");
-    free(seats);
+  if (covered != num_seats) {
+    fprintf(stderr, "Could not get seats\n");
     return 1;
   }
 
-  for (size_t i = 1; i <= num_matrix[0]; i++) {
-    for (size_t j = 1; j <= num_matrix[1]; j++) {
-      char buffer[16];
-      sprintf(buffer, "%u", seats[(i - 1) * num_matrix[1] + (j - 1)]);
-
-      if (print_str(out_fd, buffer)) {
-        perror("Error writing to file descriptor");
-        free(seats);
-        return 1;
-      }
+  size_t seat = 0;
+  for (size_t i = 0; i < num_runs; i++) {
+    uint32_t run[2];  // Contains length, reservation id
+    memcpy(run, runs + i * sizeof(run), sizeof(run));
 
-      if (j < num_matrix[1]) {
-        if (print_str(out_fd, " ")) {
-          perror("Error writing to file descriptor");
-          free(seats);
-          return 1;
-        }
-      }
+    for (uint32_t j = 0; j < run[0]; j++, seat++) {
+      if (print_seat(out_fd, run[1], (seat + 1) % num_matrix[1] == 0)) return 1;
     }
+  }
 
-    if (print_str(out_fd, "\n")) {
-      perror("Error writing to file descriptor");
-      free(seats);
-      return 1;
-    }
+  return 0;
+}
+
+/// Prints the seats of a SHOW response.
+/// @param out_fd File descriptor to print the event to.
+/// @param body Body of the response, without the return value.
+/// @param body_size Size of the body.
+/// @param run_length Whether the seats may be sent as runs of equal seats.
+/// @return 0 if successful, 1 otherwise.
+static int print_show(int out_fd, const char* body, size_t body_size, int run_length) {
+  size_t num_matrix[2];  // Contains num_rows, num_cols
+
+  if (body_size < sizeof(num_matrix)) {
+    fprintf(stderr, "Could not get show operation information\n");
+    return 1;
   }
-  free(seats);
+  memcpy(num_matrix, body, sizeof(num_matrix));
+  body += sizeof(num_matrix);
+  body_size -= sizeof(num_matrix);
 
-  if (safe_read(pipes.resp_fd, &return_value, sizeof(int)) <= 0) {
-    perror("Could not read return value of operation");
+  size_t num_seats = num_matrix[0] * num_matrix[1];
+  if (num_matrix[1] && num_seats / num_matrix[1] != num_matrix[0]) {
+    fprintf(stderr, "Could not get seats\n");
     return 1;
   }
 
-  return return_value;
-}
+  if (run_length) {
+    uint32_t num_runs;
+    if (body_size < sizeof(uint32_t)) {
+      fprintf(stderr, "Could not get seats\n");
+      return 1;
+    }
+    memcpy(&num_runs, body, sizeof(uint32_t));
+    body += sizeof(uint32_t);
+    body_size -= sizeof(uint32_t);
 
-int ems_list_events(int out_fd) {
-  char op = (char)OP_LIST;
-  int return_value = 1;
-  size_t num_seats = 0;
+    if (num_runs != UNENCODED_RUNS) {
+      if (num_runs != body_size / (2 * sizeof(uint32_t)) || body_size % (2 * sizeof(uint32_t)) != 0) {
+        fprintf(stderr, "Could not get seats\n");
+        return 1;
+      }
+      return print_runs(out_fd, num_matrix, body, num_runs);
+    }
+  }
 
-  if (safe_write(pipes.req_fd, &op, sizeof(char)) < 0) {
-    perror("Could not send operation code");
+  if (num_seats != body_size / sizeof(int)) {
+    fprintf(stderr, "Could not get seats\n");
     return 1;
   }
 
-  if (safe_read(pipes.resp_fd, &num_seats, sizeof(size_t)) < 0) {
-    perror("Could not get list operation information");
-    return 1;
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int seat;
+    memcpy(&seat, body + i * sizeof(int), sizeof(int));
+    if (print_seat(out_fd, seat, (i + 1) % num_matrix[1] == 0)) return 1;
   }
 
-  unsigned int* ids = (unsigned int*)malloc(sizeof(int) * num_seats);
-  if (ids == NULL) {
-    fprintf(stderr, "Could not allocate memory for event ids.\n");
+  return 0;
+}
+
+/// Prints the event ids of a LIST response.
+/// @param out_fd File descriptor to print the events to.
+/// @param body Body of the response, without the return value.
+/// @param body_size Size of the body.
+/// @return 0 if successful, 1 otherwise.
+static int print_list(int out_fd, const char* body, size_t body_size) {
+  size_t num_events = 0;
+
+  if (body_size < sizeof(size_t)) {
+    fprintf(stderr, "Could not get list operation information\n");
     return 1;
   }
-  if (safe_read(pipes.resp_fd, ids, sizeof(int) * num_seats) < 0) {
-    perror("Could not read list operation information");
-    free(ids);
+  memcpy(&num_events, body, sizeof(size_t));
+  body += sizeof(size_t);
+
+  if (num_events != (body_size - sizeof(size_t)) / sizeof(int)) {
+    fprintf(stderr, "Could not read list operation information\n");
     return 1;
   }
 
-  if (!num_seats) {
+  if (!num_events) {
     if (print_str(out_fd, "No events\n")) {
       perror("Error writing to file descriptor");
-      free(ids);
       return 1;
     }
   } else {
-    for (size_t i = 0; i < num_seats; i++) {
+    for (size_t i = 0; i < num_events; i++) {
       char buff[] = "Event: ";
       if (print_str(out_fd, buff)) {
         perror("Error writing to file descriptor");
-        free(ids);
         return 1;
       }
 
+      unsigned int event_id;
+      memcpy(&event_id, body + i * sizeof(int), sizeof(int));
+
       char id[16];
-      sprintf(id, "%u\n", ids[i]);
+      sprintf(id, "%u\n", event_id);
       if (print_str(out_fd, id)) {
         perror("Error writing to file descriptor");
-        free(ids);
         return 1;
       }
     }
   }
-  free(ids);
 
-  if (safe_read(pipes.resp_fd, &return_value, sizeof(int)) <= 0) {
-    perror("Could not read return value of operation");
+  return 0;
+}
+
+/// Stores the first seat of a RESERVE_BEST response.
+/// @param first_seat Array of size 2 to store the row and the column in.
+/// @param body Body of the response, without the return value.
+/// @param body_size Size of the body.
+/// @return 0 if successful, 1 otherwise.
+static int store_first_seat(size_t* first_seat, const char* body, size_t body_size) {
+  uint32_t seat[2];  // Contains row, col
+
+  if (body_size != sizeof(seat)) {
+    fprintf(stderr, "Could not get reserved seats\n");
+    return 1;
+  }
+  memcpy(seat, body, sizeof(seat));
+
+  first_seat[0] = seat[0];
+  first_seat[1] = seat[1];
+  return 0;
+}
+
+/// Stores the counts of a STATS response.
+/// @param stats Where to store the counts, left as they were on failure.
+/// @param body Body of the response, without the return value.
+/// @param body_size Size of the body.
+/// @return 0 if successful, 1 otherwise.
+static int store_stats(EmsStats_t* stats, const char* body, size_t body_size) {
+  size_t num_matrix[2];  // Contains num_rows, num_cols
+  uint32_t header[2];    // Contains the number of reservations, the number of seats reserved
+
+  if (body_size < sizeof(num_matrix) + sizeof(header)) {
+    fprintf(stderr, "Could not get statistics\n");
+    return 1;
+  }
+  memcpy(num_matrix, body, sizeof(num_matrix));
+  memcpy(header, body + sizeof(num_matrix), sizeof(header));
+  body += sizeof(num_matrix) + sizeof(header);
+  body_size -= sizeof(num_matrix) + sizeof(header);
+
+  // The rows are only sent if they were asked for
+  uint32_t* row_reserved = NULL;
+  if (body_size > 0) {
+    if (body_size / sizeof(uint32_t) != num_matrix[0] || body_size % sizeof(uint32_t) != 0) {
+      fprintf(stderr, "Could not get statistics\n");
+      return 1;
+    }
+
+    row_reserved = malloc(body_size);
+    if (row_reserved == NULL) {
+      fprintf(stderr, "Error allocating memory for statistics\n");
+      return 1;
+    }
+    memcpy(row_reserved, body, body_size);
+  }
+
+  stats->num_rows = num_matrix[0];
+  stats->num_cols = num_matrix[1];
+  stats->reservations = header[0];
+  stats->reserved = header[1];
+  stats->row_reserved = row_reserved;
+  return 0;
+}
+
+/// Updates a copy of the seats of an event with a SHOW_SINCE response.
+/// @param map Copy of the seats, left as it was on failure.
+/// @param body Body of the response, without the return value.
+/// @param body_size Size of the body.
+/// @return 0 if successful, 1 otherwise.
+static int apply_changes(EmsSeatMap_t* map, const char* body, size_t body_size) {
+  size_t num_matrix[2];  // Contains num_rows, num_cols
+  uint32_t header[2];    // Contains the last reservation accounted for, the number of pairs
+
+  if (body_size < sizeof(num_matrix) + sizeof(header)) {
+    fprintf(stderr, "Could not get show operation information\n");
+    return 1;
+  }
+  memcpy(num_matrix, body, sizeof(num_matrix));
+  memcpy(header, body + sizeof(num_matrix), sizeof(header));
+  body += sizeof(num_matrix) + sizeof(header);
+  body_size -= sizeof(num_matrix) + sizeof(header);
+
+  size_t num_seats = num_matrix[0] * num_matrix[1];
+  if ((num_matrix[1] && num_seats / num_matrix[1] != num_matrix[0]) ||
+      2 * header[1] * sizeof(uint32_t) != body_size ||
+      (map->seats != NULL && (map->num_rows != num_matrix[0] || map->num_cols != num_matrix[1]))) {
+    fprintf(stderr, "Could not get seats\n");
     return 1;
   }
 
+  for (size_t i = 0; i < header[1]; i++) {
+    uint32_t index;
+    memcpy(&index, body + 2 * i * sizeof(uint32_t), sizeof(uint32_t));
+    if (index >= num_seats) {
+      fprintf(stderr, "Could not get seats\n");
+      return 1;
+    }
+  }
+
+  // The first update starts from every seat being free
+  if (map->seats == NULL) {
+    map->seats = calloc(num_seats > 0 ? num_seats : 1, sizeof(unsigned int));
+    if (map->seats == NULL) {
+      fprintf(stderr, "Error allocating memory for event data\n");
+      return 1;
+    }
+    map->num_rows = num_matrix[0];
+    map->num_cols = num_matrix[1];
+  }
+
+  for (size_t i = 0; i < header[1]; i++) {
+    uint32_t pair[2];  // Contains index, reservation id
+    memcpy(pair, body + 2 * i * sizeof(uint32_t), sizeof(pair));
+    map->seats[pair[0]] = pair[1];
+  }
+  map->reservations = header[0];
+
+  return 0;
+}
+
+/// Prints the body of a response, if it has one, and frees it.
+/// @param handler What to do with the response.
+/// @param response Response without its frame, may be `NULL`.
+/// @param response_size Size of the response.
+/// @return Return value of the operation, 1 if there is no response or it could not be printed.
+static int handle_response(const ResponseHandler_t* handler, char* response, size_t response_size) {
+  int return_value;
+  if (response == NULL) return 1;
+
+  // The return value is last, after the body
+  size_t body_size = response_size - sizeof(int);
+  memcpy(&return_value, response + body_size, sizeof(int));
+
+  // Conditional requests get the version first. If it did not change, nothing follows it
+  const char* body = response;
+  char op = handler->op;
+  if ((op == OP_SHOW_IF_CHANGED || op == OP_LIST_IF_CHANGED) && return_value == 0) {
+    if (body_size < sizeof(uint32_t)) {
+      fprintf(stderr, "Could not get version\n");
+      return_value = 1;
+    } else {
+      memcpy(handler->version, body, sizeof(uint32_t));
+      body += sizeof(uint32_t);
+      body_size -= sizeof(uint32_t);
+      if (body_size > 0) op = op == OP_SHOW_IF_CHANGED ? OP_SHOW : OP_LIST;
+    }
+  }
+
+  // A section is printed as an event of its size
+  if (op == OP_SHOW_RANGE) op = OP_SHOW;
+
+  if (op == OP_SHOW && print_show(handler->out_fd, body, body_size, handler->run_length)) return_value = 1;
+  if (op == OP_LIST && print_list(handler->out_fd, body, body_size)) return_value = 1;
+  if (op == OP_SHOW_SINCE && return_value == 0 && apply_changes(handler->seat_map, body, body_size)) return_value = 1;
+  if (op == OP_STATS && return_value == 0 && store_stats(handler->stats, body, body_size)) return_value = 1;
+  if (op == OP_RESERVE_BEST && return_value == 0 && handler->first_seat != NULL &&
+      store_first_seat(handler->first_seat, body, body_size))
+    return_value = 1;
+
+  free(response);
   return return_value;
 }
+
+int ems_receive(EmsConnection_t* connection, uint32_t request_id, enum OpCodes* op) {
+  ResponseHandler_t handler = {.op = OP_NONE};
+  size_t response_size;
+
+  char* response = wait_response(connection, request_id, &handler, &response_size);
+  if (op != NULL) *op = (enum OpCodes)handler.op;
+
+  return handle_response(&handler, response, response_size);
+}
+
+int ems_completion_fd(EmsConnection_t* connection) { return connection->completion_fd; }
+
+/// Runs the watch callback for a pushed reservation, then frees it.
+/// @param callback Watch callback of the connection, may be `NULL`.
+/// @param ctx Argument passed to `callback`.
+/// @param push Pushed reservation.
+static void handle_push(EmsWatchCallback_t callback, void* ctx, PushedReservation_t* push) {
+  uint32_t header[3];  // Contains event_id, reservation_id, num_seats
+
+  // The push starts 8-byte aligned, so its seats can be passed without being copied
+  if (push->size < sizeof(header) + sizeof(int)) {
+    fprintf(stderr, "Could not get pushed reservation\n");
+  } else {
+    memcpy(header, push->push, sizeof(header));
+    if (header[2] != (push->size - sizeof(header) - sizeof(int)) / sizeof(uint32_t)) {
+      fprintf(stderr, "Could not get pushed reservation\n");
+    } else if (callback != NULL) {
+      callback(header[0], header[1], header[2], (const uint32_t*)(void*)(push->push + sizeof(header)), ctx);
+    }
+  }
+
+  free(push);
+}
+
+size_t ems_dispatch(EmsConnection_t* connection) {
+  size_t dispatched = 0;
+
+  // Takes the requests completed and the reservations pushed so far, later ones are signaled again on the eventfd
+  pthread_mutex_lock(&connection->pending_lock);
+  size_t index = connection->completed_head;
+  connection->completed_head = connection->completed_tail = NO_REQUEST;
+  PushedReservation_t* push = connection->pushes_head;
+  connection->pushes_head = connection->pushes_tail = NULL;
+  EmsWatchCallback_t watch_callback = connection->watch_callback;
+  void* watch_ctx = connection->watch_ctx;
+
+  uint64_t signals;
+  if (read(connection->completion_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN)
+    perror("Could not read completion eventfd");
+  pthread_mutex_unlock(&connection->pending_lock);
+
+  while (index != NO_REQUEST) {
+    PendingRequest_t* request = &connection->pending[index];
+
+    // The slot is freed before the callback runs, so the callback may send another request
+    pthread_mutex_lock(&connection->pending_lock);
+    ResponseHandler_t handler = request->handler;
+    char* response = request->response;
+    size_t response_size = request->response_size;
+    index = request->next_completed;
+
+    request->response = NULL;
+    request->state = REQUEST_FREE;
+    pthread_cond_broadcast(&connection->slot_freed);
+    pthread_mutex_unlock(&connection->pending_lock);
+
+    if (response == NULL) fprintf(stderr, "Connection to the server was lost\n");
+    handler.callback(handle_response(&handler, response, response_size), handler.ctx);
+    dispatched++;
+  }
+
+  while (push != NULL) {
+    PushedReservation_t* next = push->next;
+    handle_push(watch_callback, watch_ctx, push);
+    push = next;
+    dispatched++;
+  }
+
+  return dispatched;
+}
+
+int ems_create(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  uint32_t request_id;
+  if (ems_send_create(connection, event_id, num_rows, num_cols, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_reserve(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  uint32_t request_id;
+  if (ems_send_reserve(connection, event_id, num_seats, xs, ys, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_reserve_best(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* row, size_t* col) {
+  uint32_t request_id;
+  size_t first_seat[2];
+  ResponseHandler_t handler = {.out_fd = -1, .first_seat = first_seat};
+  if (send_reserve_best(connection, handler, event_id, num_seats, &request_id)) return 1;
+  if (ems_receive(connection, request_id, NULL)) return 1;
+
+  *row = first_seat[0];
+  *col = first_seat[1];
+  return 0;
+}
+
+int ems_show(EmsConnection_t* connection, int out_fd, unsigned int event_id) {
+  uint32_t request_id;
+  if (ems_send_show(connection, out_fd, event_id, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_show_range(EmsConnection_t* connection, int out_fd, unsigned int event_id, size_t row_lo, size_t row_hi,
+                   size_t col_lo, size_t col_hi) {
+  uint32_t request_id;
+  const size_t range[4] = {row_lo, row_hi, col_lo, col_hi};
+  if (send_show_range(connection, (ResponseHandler_t){.out_fd = out_fd}, event_id, range, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_list_events(EmsConnection_t* connection, int out_fd) {
+  uint32_t request_id;
+  if (ems_send_list_events(connection, out_fd, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_show_if_changed(EmsConnection_t* connection, int out_fd, unsigned int event_id, uint32_t* version) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = out_fd, .version = version};
+  if (send_show_if_changed(connection, handler, event_id, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_list_events_if_changed(EmsConnection_t* connection, int out_fd, uint32_t* version) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = out_fd, .version = version};
+  if (send_list_events_if_changed(connection, handler, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_show_since(EmsConnection_t* connection, unsigned int event_id, EmsSeatMap_t* map) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = -1, .seat_map = map};
+  if (send_show_since(connection, handler, event_id, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_stats(EmsConnection_t* connection, unsigned int event_id, int per_row, EmsStats_t* stats) {
+  if (connection->version < PROTOCOL_STATS) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_STATS);
+    return 1;
+  }
+
+  char op = (char)OP_STATS;
+  uint32_t rows_requested = per_row != 0;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &event_id, .iov_len = sizeof(int)},
+                            {.iov_base = &rows_requested, .iov_len = sizeof(uint32_t)}};
+
+  uint32_t request_id;
+  ResponseHandler_t handler = {.op = OP_STATS, .out_fd = -1, .stats = stats};
+  if (submit_request(connection, handler, request, 3, &request_id)) return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_watch(EmsConnection_t* connection, size_t num_events, const unsigned int* event_ids,
+              EmsWatchCallback_t callback, void* ctx) {
+  if (connection->version < PROTOCOL_WATCH) {
+    fprintf(stderr, "Server does not support protocol version %d\n", PROTOCOL_WATCH);
+    return 1;
+  }
+  if (num_events > WATCH_MAX_EVENTS) {
+    fprintf(stderr, "Too many events to watch\n");
+    return 1;
+  }
+
+  // Set before the request is sent, reservations may be pushed before its response
+  pthread_mutex_lock(&connection->pending_lock);
+  connection->watch_callback = callback;
+  connection->watch_ctx = ctx;
+  pthread_mutex_unlock(&connection->pending_lock);
+
+  char op = (char)OP_WATCH;
+  uint32_t count = (uint32_t)num_events;
+  struct iovec request[] = {{.iov_base = &op, .iov_len = sizeof(char)},
+                            {.iov_base = &count, .iov_len = sizeof(uint32_t)},
+                            {.iov_base = (void*)event_ids, .iov_len = num_events * sizeof(int)}};
+
+  uint32_t request_id;
+  if (submit_request(connection, (ResponseHandler_t){.op = OP_WATCH, .out_fd = -1}, request, 3, &request_id))
+    return 1;
+  return ems_receive(connection, request_id, NULL);
+}
+
+int ems_create_async(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols,
+                     EmsCallback_t callback, void* ctx) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = -1, .callback = callback, .ctx = ctx};
+  return send_create(connection, handler, event_id, num_rows, num_cols, &request_id);
+}
+
+int ems_reserve_async(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys,
+                      EmsCallback_t callback, void* ctx) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = -1, .callback = callback, .ctx = ctx};
+  return send_reserve(connection, handler, event_id, num_seats, xs, ys, &request_id);
+}
+
+int ems_show_async(EmsConnection_t* connection, int out_fd, unsigned int event_id, EmsCallback_t callback,
+                   void* ctx) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = out_fd, .callback = callback, .ctx = ctx};
+  return send_show(connection, handler, event_id, &request_id);
+}
+
+int ems_list_events_async(EmsConnection_t* connection, int out_fd, EmsCallback_t callback, void* ctx) {
+  uint32_t request_id;
+  ResponseHandler_t handler = {.out_fd = out_fd, .callback = callback, .ctx = ctx};
+  return send_list_events(connection, handler, &request_id);
+}
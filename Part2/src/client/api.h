@@ -3,53 +3,274 @@
 
 #include <common/constants.h>
 #include <stddef.h>
+#include <stdint.h>
 
-typedef struct ConnectionPipes {
-  char req_pipe[MAX_PIPE_NAME_SIZE];
-  char resp_pipe[MAX_PIPE_NAME_SIZE];
-  int req_fd;
-  int resp_fd;
-} ConnectionPipes_t;
+#define CLIENT_INBOX_SIZE 8192  // Received bytes kept until a response asks for them
+#define MAX_IN_FLIGHT 256       // Maximum number of requests of a connection waiting for a response
+
+/// Session with an EMS server. Every function taking one may be called from any number of threads at once:
+/// their requests share the session and a background thread hands each response to the thread waiting for it.
+typedef struct EmsConnection EmsConnection_t;
+
+/// Copy of the seats of an event kept by the client, brought up to date with `ems_show_since`.
+typedef struct EmsSeatMap {
+  size_t num_rows;
+  size_t num_cols;
+  uint32_t reservations;  // Id of the last reservation of the event accounted for in the copy
+  unsigned int* seats;    // Reservation id of each seat, row by row. `NULL` before the first update
+} EmsSeatMap_t;
+
+/// How many seats of an event are reserved, as counted by `ems_stats`.
+typedef struct EmsStats {
+  size_t num_rows;
+  size_t num_cols;
+  uint32_t reservations;   // Number of reservations of the event
+  uint32_t reserved;       // Number of seats reserved
+  uint32_t* row_reserved;  // Number of seats reserved in each row, `NULL` if they were not asked for
+} EmsStats_t;
+
+/// Called with the return value of an operation started with `ems_*_async`, 1 if its response could not be received.
+typedef void (*EmsCallback_t)(int return_value, void* ctx);
+
+/// Called for each reservation of an event watched with `ems_watch`, with the index of each seat reserved (row by
+/// row, starting at 0). Without seats, the reservations of the event after `reservation_id` were dropped because the
+/// application fell behind: they must be fetched with `ems_show_since`, with `reservations` of the map lowered to
+/// `reservation_id` if it is higher.
+typedef void (*EmsWatchCallback_t)(unsigned int event_id, uint32_t reservation_id, size_t num_seats,
+                                   const uint32_t* seats, void* ctx);
 
 /// Connects to an EMS server.
+/// @note If `server_pipe_path` is a Unix domain socket, the connection is made through it
+/// and no named pipes are created.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
 /// @param resp_pipe_path Path to the name pipe to be created for responses.
-/// @param server_pipe_path Path to the name pipe where the server is listening.
-/// @return 0 if the connection was established successfully, 1 otherwise.
-int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
+/// @param server_pipe_path Path to the name pipe or socket where the server is listening.
+/// @return Handle of the connection, `NULL` if it could not be established.
+EmsConnection_t* ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
 
-/// Auxiliary function for closing and unlinking the created named pipes.
-/// @return 0 if successful, 1 otherwise.
-int close_pipes(void);
+/// Moves the connection to a shared memory region, so requests and responses no longer go through the kernel.
+/// @note The pipes stay open so that each side notices if the other one is gone.
+/// @param connection Connection to the server.
+/// @return 0 if the server attached the shared memory, 1 otherwise, in which case the pipes are still used.
+int ems_attach_shared_memory(EmsConnection_t* connection);
 
-/// Disconnects from an EMS server.
+/// Disconnects from an EMS server and frees the connection.
+/// @note No other thread may use the connection during or after this call.
+/// @param connection Connection to the server.
 /// @return 0 in case of success, 1 otherwise.
-int ems_quit(void);
+int ems_quit(EmsConnection_t* connection);
+
+/// Sends a request to create a new event, without waiting for the response.
+/// @note The response must be received with `ems_receive`.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_send_create(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols,
+                    uint32_t* request_id);
+
+/// Sends a request to create a new reservation, without waiting for the response.
+/// @note The response must be received with `ems_receive`.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_send_reserve(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys,
+                     uint32_t* request_id);
+
+/// Sends a request to reserve adjacent seats wherever they are free, without waiting for the response.
+/// @note The response must be received with `ems_receive`. The seats reserved are not stored, see `ems_reserve_best`.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_send_reserve_best(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, uint32_t* request_id);
+
+/// Sends a request to show an event, without waiting for the response.
+/// @note The response must be received with `ems_receive`, which prints the event.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the event to.
+/// @param event_id Id of the event to print.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_send_show(EmsConnection_t* connection, int out_fd, unsigned int event_id, uint32_t* request_id);
+
+/// Sends a request to list the events, without waiting for the response.
+/// @note The response must be received with `ems_receive`, which prints the events.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the events to.
+/// @param request_id Pointer to store the id of the request in.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_send_list_events(EmsConnection_t* connection, int out_fd, uint32_t* request_id);
+
+/// Waits for the response to a request sent with `ems_send_*`. Responses may be received in any order,
+/// but each request must be received exactly once.
+/// @param connection Connection to the server.
+/// @param request_id Id of the request.
+/// @param op Pointer to store the operation code of the request in, may be `NULL`.
+/// @return Return value of the operation, 1 if the response could not be received.
+int ems_receive(EmsConnection_t* connection, uint32_t request_id, enum OpCodes* op);
 
 /// Creates a new event with the given id and dimensions.
+/// @param connection Connection to the server.
 /// @param event_id Id of the event to be created.
 /// @param num_rows Number of rows of the event to be created.
 /// @param num_cols Number of columns of the event to be created.
 /// @return 0 if the event was created successfully, 1 otherwise.
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+int ems_create(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols);
 
 /// Creates a new reservation for the given event.
+/// @param connection Connection to the server.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
 /// @return 0 if the reservation was created successfully, 1 otherwise.
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
+int ems_reserve(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
+
+/// Reserves adjacent seats in a row of the given event wherever they are free, instead of at given coordinates.
+/// @note The server picks the first row with room and the first seats with room in it, so no retries are needed
+/// while other clients take seats.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve, at most `MAX_RESERVATION_SIZE`.
+/// @param row Pointer to store the row of the seats reserved in.
+/// @param col Pointer to store the column of the first seat reserved in. The others follow it.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* row, size_t* col);
 
 /// Prints the given event to the given file.
+/// @param connection Connection to the server.
 /// @param out_fd File descriptor to print the event to.
 /// @param event_id Id of the event to print.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int out_fd, unsigned int event_id);
+int ems_show(EmsConnection_t* connection, int out_fd, unsigned int event_id);
+
+/// Prints a section of the given event to the given file, as `ems_show` would print an event of that size.
+/// @note Only the section is read and sent by the server, so it costs the same however large the event is.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the section to.
+/// @param event_id Id of the event to print.
+/// @param row_lo First row of the section, starting at 1.
+/// @param row_hi Last row of the section.
+/// @param col_lo First column of the section, starting at 1.
+/// @param col_hi Last column of the section.
+/// @return 0 if the section was printed successfully, 1 otherwise.
+int ems_show_range(EmsConnection_t* connection, int out_fd, unsigned int event_id, size_t row_lo, size_t row_hi,
+                   size_t col_lo, size_t col_hi);
 
 /// Prints all the events to the given file.
+/// @param connection Connection to the server.
 /// @param out_fd File descriptor to print the events to.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int out_fd);
+int ems_list_events(EmsConnection_t* connection, int out_fd);
+
+/// Prints the given event to the given file, unless it did not change since it was last printed.
+/// @note Meant for polling: if the event did not change, the response is a few bytes instead of every seat.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the event to.
+/// @param event_id Id of the event to print.
+/// @param version Version of the event printed last, 0 if none. The version printed is stored in it.
+/// @return 0 if the event was printed or did not change, 1 otherwise.
+int ems_show_if_changed(EmsConnection_t* connection, int out_fd, unsigned int event_id, uint32_t* version);
+
+/// Prints all the events to the given file, unless no event was created since they were last printed.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the events to.
+/// @param version Version of the events printed last, 0 if none. The version printed is stored in it.
+/// @return 0 if the events were printed or did not change, 1 otherwise.
+int ems_list_events_if_changed(EmsConnection_t* connection, int out_fd, uint32_t* version);
+
+/// Brings a copy of the seats of an event up to date, receiving only the seats reserved since its last update.
+/// @note What is received depends on how many seats were reserved since then, not on the size of the event.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event.
+/// @param map Copy of the seats of the event, zero-initialized before the first update. `map->seats` must be
+/// freed by the caller.
+/// @return 0 if the copy was updated, 1 otherwise, in which case it is left as it was.
+int ems_show_since(EmsConnection_t* connection, unsigned int event_id, EmsSeatMap_t* map);
+
+/// Gets how many seats of an event are reserved, instead of counting them in the whole event.
+/// @note The server keeps the counts up to date, so the response has a few bytes, or a few per row, whatever the
+/// size of the event. Meant for applications polling the availability of many events.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event.
+/// @param per_row Whether to also get the number of seats reserved in each row.
+/// @param stats Where to store the counts. `stats->row_reserved` must be freed by the caller.
+/// @return 0 if the counts were stored, 1 otherwise.
+int ems_stats(EmsConnection_t* connection, unsigned int event_id, int per_row, EmsStats_t* stats);
+
+/// Starts receiving the reservations of the given events as the server makes them, instead of polling the events.
+/// @note Reservations made before this returns may or may not be received, so a copy of the seats should be brought
+/// up to date with `ems_show_since` afterwards. Receiving one twice does no harm.
+/// @param connection Connection to the server.
+/// @param num_events Number of events, which added to those already watched may be at most `WATCH_MAX_EVENTS`.
+/// @param event_ids Ids of the events.
+/// @param callback Function `ems_dispatch` calls for each reservation, replacing the one of earlier calls.
+/// @param ctx Argument passed to `callback`.
+/// @return 0 if every event is watched, 1 otherwise, in which case none of them was added.
+int ems_watch(EmsConnection_t* connection, size_t num_events, const unsigned int* event_ids,
+              EmsWatchCallback_t callback, void* ctx);
+
+/// Gets a descriptor that becomes readable when responses to `ems_*_async` operations or reservations of watched
+/// events have arrived, to be polled by the application's event loop. It is cleared by `ems_dispatch`.
+/// @param connection Connection to the server.
+/// @return Nonblocking file descriptor owned by the connection.
+int ems_completion_fd(EmsConnection_t* connection);
+
+/// Runs the callbacks of the `ems_*_async` operations whose responses have arrived, in the order they arrived,
+/// then the callback of `ems_watch` for each reservation of a watched event that arrived.
+/// @note SHOW and LIST responses are printed before their callback runs. Callbacks may start other operations.
+/// @param connection Connection to the server.
+/// @return Number of callbacks that were run.
+size_t ems_dispatch(EmsConnection_t* connection);
+
+/// Sends a request to create a new event, whose callback is run by `ems_dispatch` once the response arrives.
+/// @note Like every `ems_*_async` operation, this never waits for a response: if `MAX_IN_FLIGHT` requests are
+/// already waiting for one or for `ems_dispatch`, it fails with `errno` set to `EAGAIN`.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @param callback Function to call with the return value of the operation, not `NULL`.
+/// @param ctx Argument passed to `callback`.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_create_async(EmsConnection_t* connection, unsigned int event_id, size_t num_rows, size_t num_cols,
+                     EmsCallback_t callback, void* ctx);
+
+/// Sends a request to create a new reservation, whose callback is run by `ems_dispatch` once the response arrives.
+/// @param connection Connection to the server.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param callback Function to call with the return value of the operation, not `NULL`.
+/// @param ctx Argument passed to `callback`.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_reserve_async(EmsConnection_t* connection, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys,
+                      EmsCallback_t callback, void* ctx);
+
+/// Sends a request to show an event, which `ems_dispatch` prints once the response arrives.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the event to.
+/// @param event_id Id of the event to print.
+/// @param callback Function to call with the return value of the operation, not `NULL`.
+/// @param ctx Argument passed to `callback`.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_show_async(EmsConnection_t* connection, int out_fd, unsigned int event_id, EmsCallback_t callback, void* ctx);
+
+/// Sends a request to list the events, which `ems_dispatch` prints once the response arrives.
+/// @param connection Connection to the server.
+/// @param out_fd File descriptor to print the events to.
+/// @param callback Function to call with the return value of the operation, not `NULL`.
+/// @param ctx Argument passed to `callback`.
+/// @return 0 if the request was sent, 1 otherwise.
+int ems_list_events_async(EmsConnection_t* connection, int out_fd, EmsCallback_t callback, void* ctx);
 
 #endif  // CLIENT_API_H
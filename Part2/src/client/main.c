@@ -1,5 +1,7 @@
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
@@ -8,24 +10,106 @@
 #include "common/constants.h"
 #include "parser.h"
 
+/// Prints the client's command line syntax.
+/// @param program Name of the client executable.
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-m] [-w window] <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
+          program);
+}
+
+/// Prints the return value of a command.
+/// @param op Operation code of the command.
+/// @param return_value Return value of the command.
+static void print_result(enum OpCodes op, int return_value) {
+  const char* name = op == OP_CREATE         ? "CREATE"
+                     : op == OP_RESERVE      ? "RESERVE"
+                     : op == OP_RESERVE_BEST ? "RESERVE_BEST"
+                     : op == OP_SHOW         ? "SHOW"
+                                             : "LIST";
+  fprintf(stderr, "%s command returned %d\n", name, return_value);
+}
+
+/// Requests sent by the client that are waiting for a response, in the order they were sent.
+typedef struct CommandWindow {
+  uint32_t request_ids[MAX_IN_FLIGHT];  // Circular queue
+  size_t start;
+  size_t count;
+} CommandWindow_t;
+
+/// Receives responses until at most `window` - 1 commands are waiting for one.
+/// @param connection Connection to the server.
+/// @param commands Commands waiting for a response.
+/// @param window Number of commands allowed to wait for a response, 1 to wait for every response.
+static void complete_commands(EmsConnection_t* connection, CommandWindow_t* commands, size_t window) {
+  while (commands->count >= window) {
+    enum OpCodes op;
+    int return_value = ems_receive(connection, commands->request_ids[commands->start], &op);
+    print_result(op, return_value);
+
+    commands->start = (commands->start + 1) % MAX_IN_FLIGHT;
+    commands->count--;
+  }
+}
+
+/// Remembers a command that was sent, or prints its failure.
+/// @param commands Commands waiting for a response.
+/// @param op Operation code of the command.
+/// @param send_status Return value of the `ems_send_*` call.
+/// @param request_id Pointer to the id of the request, only read if it was sent.
+static void track_command(CommandWindow_t* commands, enum OpCodes op, int send_status, const uint32_t* request_id) {
+  if (send_status) {
+    print_result(op, 1);
+    return;
+  }
+
+  commands->request_ids[(commands->start + commands->count++) % MAX_IN_FLIGHT] = *request_id;
+}
+
 int main(int argc, char* argv[]) {
-  if (argc < 5) {
-    fprintf(stderr, "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
-            argv[0]);
+  int shared_memory = 0;
+  size_t window = 1;
+  char* endptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "mw:")) != -1) {
+    switch (opt) {
+      case 'm':
+        shared_memory = 1;
+        break;
+
+      case 'w':
+        window = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || window == 0 || window > MAX_IN_FLIGHT) {
+          fprintf(stderr, "Invalid window size (1 to %d)\n", MAX_IN_FLIGHT);
+          return 1;
+        }
+        break;
+
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind < 4) {
+    print_usage(argv[0]);
     return 1;
   }
+  argc -= optind - 1;
+  argv += optind - 1;
 
-  if (ems_setup(argv[1], argv[2], argv[3])) {
+  EmsConnection_t* connection = ems_setup(argv[1], argv[2], argv[3]);
+  if (connection == NULL) {
     fprintf(stderr, "Failed to set up EMS\n");
-    close_pipes();
     return 1;
   }
 
+  if (shared_memory && ems_attach_shared_memory(connection)) fprintf(stderr, "Shared memory is unavailable, using pipes\n");
+
   const char* dot = strrchr(argv[4], '.');
   if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
       strlen(argv[4]) > MAX_JOB_FILE_NAME_SIZE) {
     fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", argv[1]);
-    close_pipes();
+    ems_quit(connection);
     return 1;
   }
 
@@ -36,24 +120,27 @@ int main(int argc, char* argv[]) {
   int in_fd = open(argv[4], O_RDONLY);
   if (in_fd == -1) {
     fprintf(stderr, "Failed to open input file. Path: %s\n", argv[4]);
-    close_pipes();
+    ems_quit(connection);
     return 1;
   }
 
   int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
   if (out_fd == -1) {
     fprintf(stderr, "Failed to open output file. Path: %s\n", out_path);
-    close_pipes();
+    ems_quit(connection);
     close(in_fd);
     return 1;
   }
 
+  CommandWindow_t commands = {.start = 0, .count = 0};
+  uint32_t request_id = 0;
+
+  // Up to `window` commands are sent before waiting for the response to the first one
   while (1) {
     unsigned int event_id;
     unsigned int delay = 0;
-    size_t num_rows, num_columns, num_coords;
+    size_t num_rows, num_columns, num_coords, num_seats;
     size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
-    int return_value;
 
     switch (get_next(in_fd)) {
       case CMD_CREATE:
@@ -62,8 +149,8 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        return_value = ems_create(event_id, num_rows, num_columns);
-        fprintf(stderr, "CREATE command returned %d\n", return_value);
+        track_command(&commands, OP_CREATE, ems_send_create(connection, event_id, num_rows, num_columns, &request_id),
+                      &request_id);
         break;
 
       case CMD_RESERVE:
@@ -74,8 +161,18 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        return_value = ems_reserve(event_id, num_coords, xs, ys);
-        fprintf(stderr, "RESERVE command returned %d\n", return_value);
+        track_command(&commands, OP_RESERVE, ems_send_reserve(connection, event_id, num_coords, xs, ys, &request_id),
+                      &request_id);
+        break;
+
+      case CMD_RESERVE_BEST:
+        if (parse_reserve_best(in_fd, &event_id, &num_seats) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        track_command(&commands, OP_RESERVE_BEST, ems_send_reserve_best(connection, event_id, num_seats, &request_id),
+                      &request_id);
         break;
 
       case CMD_SHOW:
@@ -84,13 +181,11 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        return_value = ems_show(out_fd, event_id);
-        fprintf(stderr, "SHOW command returned %d\n", return_value);
+        track_command(&commands, OP_SHOW, ems_send_show(connection, out_fd, event_id, &request_id), &request_id);
         break;
 
       case CMD_LIST_EVENTS:
-        return_value = ems_list_events(out_fd);
-        fprintf(stderr, "LIST command returned %d\n", return_value);
+        track_command(&commands, OP_LIST, ems_send_list_events(connection, out_fd, &request_id), &request_id);
         break;
 
       case CMD_WAIT:
@@ -99,6 +194,8 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
+        // Commands before a WAIT must be done before it starts
+        complete_commands(connection, &commands, 1);
         if (delay > 0) {
           printf("Waiting...\n");
           struct timespec delay_spec = {delay / 1000, (delay % 1000) * 1000000};
@@ -115,6 +212,7 @@ int main(int argc, char* argv[]) {
             "Available commands:\n"
             "  CREATE <event_id> <num_rows> <num_columns>\n"
             "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+            "  RESERVE_BEST <event_id> <num_seats>\n"
             "  SHOW <event_id>\n"
             "  LIST\n"
             "  WAIT <delay_ms>\n"
@@ -126,10 +224,13 @@ int main(int argc, char* argv[]) {
         break;
 
       case EOC:
+        complete_commands(connection, &commands, 1);
         close(in_fd);
         close(out_fd);
-        ems_quit();
+        ems_quit(connection);
         return 0;
     }
+
+    complete_commands(connection, &commands, window);
   }
 }
\ No newline at end of file
@@ -30,12 +30,19 @@ enum Command get_next(int fd) {
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE", 7) != 0 || (buf[7] != ' ' && buf[7] != '_')) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      return CMD_RESERVE;
+      if (buf[7] == ' ') return CMD_RESERVE;
+
+      if (read(fd, buf + 8, 5) != 5 || strncmp(buf, "RESERVE_BEST ", 13) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_RESERVE_BEST;
 
     case 'S':
       if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
@@ -176,6 +183,24 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
   return num_coords;
 }
 
+int parse_reserve_best(int fd, unsigned int *event_id, size_t *num_seats) {
+  char ch;
+
+  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(fd);
+    return 1;
+  }
+
+  unsigned int u_num_seats;
+  if (parse_uint(fd, &u_num_seats, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(fd);
+    return 1;
+  }
+  *num_seats = (size_t)u_num_seats;
+
+  return 0;
+}
+
 int parse_show(int fd, unsigned int *event_id) {
   char ch;
 
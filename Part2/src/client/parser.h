@@ -6,6 +6,7 @@
 enum Command {
   CMD_CREATE,
   CMD_RESERVE,
+  CMD_RESERVE_BEST,
   CMD_SHOW,
   CMD_LIST_EVENTS,
   CMD_WAIT,
@@ -37,6 +38,13 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
 /// @return Number of coordinates read. 0 on failure.
 size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
 
+/// Parses a RESERVE_BEST command.
+/// @param fd File descriptor to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param num_seats Pointer to the variable to store the number of adjacent seats in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reserve_best(int fd, unsigned int *event_id, size_t *num_seats);
+
 /// Parses a SHOW command.
 /// @param fd File descriptor to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
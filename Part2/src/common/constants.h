@@ -5,9 +5,68 @@
 #define STATE_ACCESS_DELAY_US 500000  // 500ms
 #define MAX_JOB_FILE_NAME_SIZE 256
 #define MAX_SESSION_COUNT 8
+#define MAX_POLLER_COUNT 64
+#define MAX_DISPATCH_THREADS 64
 #define MAX_PIPE_NAME_SIZE 40
 #define SETUP_REQUEST_BUFSIZ 82
+#define SETUP_VERSION_OFFSET 81  // Byte of the setup request holding the protocol version asked for by the client
+#define WATCH_MAX_EVENTS 16      // Maximum number of events a session may watch
 
-enum OpCodes { OP_NONE, OP_SETUP, OP_QUIT, OP_CREATE, OP_RESERVE, OP_SHOW, OP_LIST };
+// Clients that ask for no version speak the legacy protocol and only get the session id back on setup.
+// Others also get the version both sides will speak, the lowest of theirs and the server's
+#define PROTOCOL_LEGACY 0
+#define PROTOCOL_COMPACT 1               // RESERVE only carries the requested seats, as 32-bit pairs
+#define PROTOCOL_FRAMED 2                // Requests and responses are frames, see `FRAME_HEADER_SIZE`
+#define PROTOCOL_TAGGED 3                // Frames start with a request id, which the response repeats
+#define PROTOCOL_CONDITIONAL 4           // SHOW and LIST may answer that nothing changed, see `OpCodes`
+#define PROTOCOL_DELTA 5                 // SHOW may only send the seats reserved lately, see `OpCodes`
+#define PROTOCOL_WATCH 6                 // Reservations of watched events are pushed to the client, see `OpCodes`
+#define PROTOCOL_RUN_LENGTH 7            // SHOW may send runs of equal seats instead of every seat, see `OpCodes`
+#define PROTOCOL_RANGE 8                 // SHOW may only send a section of the event, see `OpCodes`
+#define PROTOCOL_BEST 9                  // Adjacent seats may be reserved wherever they are free, see `OpCodes`
+#define PROTOCOL_STATS 10                // How many seats of an event are reserved may be asked for, see `OpCodes`
+#define PROTOCOL_VERSION PROTOCOL_STATS  // Newest version
+
+#define FRAME_HEADER_SIZE 4          // 32-bit length of the rest of the frame, which is one request or response
+#define REQUEST_ID_SIZE 4            // 32-bit request id at the start of `PROTOCOL_TAGGED` frames
+#define PUSH_REQUEST_ID 0xFFFFFFFFu  // Request id of the frames pushed by the server, never given to a request
+#define UNENCODED_RUNS 0xFFFFFFFFu   // Number of runs of a `PROTOCOL_RUN_LENGTH` SHOW whose seats are not encoded
+
+// Conditional SHOW and LIST carry the 32-bit version of the event or the list last seen by the client.
+// Their response starts with the current version and only goes on like a SHOW or LIST response if it differs.
+// SHOW_SINCE carries the 32-bit id of the last reservation of the event known to the client. Its response has the
+// size of the event, the id of the last reservation accounted for, the number of seats reserved after the known one
+// and an (index, reservation id) pair of 32-bit integers for each of them.
+// WATCH carries a 32-bit number of events and their 32-bit ids. Afterwards, each reservation of those events is pushed
+// in a frame tagged `PUSH_REQUEST_ID` holding the event id, the reservation id, the number of seats and the index of
+// each seat as 32-bit integers, then a 0 status. A push without seats means the client fell behind and the pushes
+// of the event after that reservation id were dropped, so they must be fetched with SHOW_SINCE.
+// From `PROTOCOL_RUN_LENGTH` on, the seats of SHOW responses start with a 32-bit number of runs. Each run is a pair of
+// 32-bit integers, the number of consecutive seats it covers and their reservation id. If the number of runs is
+// `UNENCODED_RUNS`, the seats follow as usual instead.
+// SHOW_RANGE carries the 32-bit event id, then the first and last row and the first and last column of a section of
+// the event as 32-bit integers, starting at 1. Its response is a SHOW response of an event the size of the section.
+// RESERVE_BEST carries the 32-bit event id and number of adjacent seats to reserve in a row. If they were reserved,
+// its response has the row and the column of the first seat as 32-bit integers, starting at 1.
+// STATS carries the 32-bit event id and whether to count the seats reserved in each row, 0 or 1, as a 32-bit integer.
+// Its response has the size of the event, then the number of reservations and of seats reserved as 32-bit integers,
+// then the number of seats reserved in each row as 32-bit integers if they were asked for
+enum OpCodes {
+  OP_NONE,
+  OP_SETUP,
+  OP_QUIT,
+  OP_CREATE,
+  OP_RESERVE,
+  OP_SHOW,
+  OP_LIST,
+  OP_SHM,
+  OP_SHOW_IF_CHANGED,
+  OP_LIST_IF_CHANGED,
+  OP_SHOW_SINCE,
+  OP_WATCH,
+  OP_SHOW_RANGE,
+  OP_RESERVE_BEST,
+  OP_STATS
+};
 
 #endif
\ No newline at end of file
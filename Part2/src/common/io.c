@@ -113,3 +113,31 @@ ssize_t safe_write(int fd, const void *buf, size_t nbytes) {
 
   return completed_bytes;
 }
+
+ssize_t safe_writev(int fd, struct iovec *iov, int iovcnt) {
+  ssize_t completed_bytes = 0;
+
+  while (iovcnt > 0) {
+    ssize_t wr_bytes = writev(fd, iov, iovcnt);
+
+    if (wr_bytes < 0)
+      return -1;
+    else if (wr_bytes == 0)
+      break;
+
+    completed_bytes += wr_bytes;
+
+    size_t written = (size_t)wr_bytes;
+    while (iovcnt > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  return completed_bytes;
+}
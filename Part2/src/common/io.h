@@ -2,6 +2,7 @@
 #define COMMON_IO_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /// Parses an unsigned integer from the given file descriptor.
 /// @param fd The file descriptor to read from.
@@ -36,4 +37,12 @@ ssize_t safe_read(int fd, void *buf, size_t nbytes);
 /// @return Same as the write() syscall
 ssize_t safe_write(int fd, const void *buf, size_t nbytes);
 
+/// Wrapper function that safely writes every buffer of an array to the given file descriptor
+/// @note The array is modified to skip over the data that was written
+/// @param fd File descriptor to write to
+/// @param iov Array of buffers holding write data
+/// @param iovcnt Number of buffers
+/// @return Same as the writev() syscall
+ssize_t safe_writev(int fd, struct iovec *iov, int iovcnt);
+
 #endif  // COMMON_IO_H
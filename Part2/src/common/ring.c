@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE  // syscall()
+
+#include "ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Checks whether the other end of a descriptor has been closed.
+/// @param peer_fd Descriptor to check.
+/// @return 1 if it hung up, 0 otherwise.
+static int peer_closed(int peer_fd) {
+  struct pollfd pfd = {.fd = peer_fd, .events = 0, .revents = 0};
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR));
+}
+
+/// Waits until a counter of the ring moves away from the given value.
+/// @param word Counter to wait on.
+/// @param value Last seen value of the counter.
+/// @param waiting Flag telling the peer to wake us up.
+/// @param peer_fd Descriptor that hangs up when the peer is gone.
+/// @return 0 once the counter may have changed, 1 with `errno` set to `EPIPE` if the peer is gone.
+static int ring_wait(_Atomic uint32_t *word, uint32_t value, _Atomic uint32_t *waiting, int peer_fd) {
+  for (int i = 0; i < RING_SPIN_COUNT; i++) {
+    if (atomic_load_explicit(word, memory_order_acquire) != value) return 0;
+  }
+
+  // Pairs with the fence in `ring_wake`, so either the peer sees the flag or we see the new value
+  atomic_store_explicit(waiting, 1, memory_order_seq_cst);
+  if (atomic_load_explicit(word, memory_order_seq_cst) == value) {
+    struct timespec timeout = {0, RING_WAIT_TIMEOUT_MS * 1000000L};
+    if (syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, &timeout, NULL, 0) < 0 && errno == ETIMEDOUT &&
+        peer_closed(peer_fd)) {
+      atomic_store_explicit(waiting, 0, memory_order_relaxed);
+      errno = EPIPE;
+      return 1;
+    }
+  }
+  atomic_store_explicit(waiting, 0, memory_order_relaxed);
+
+  return 0;
+}
+
+/// Wakes up the peer if it sleeps on a counter that was just updated.
+/// @param word Updated counter.
+/// @param waiting Flag set by the peer before sleeping.
+static void ring_wake(_Atomic uint32_t *word, _Atomic uint32_t *waiting) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiting, memory_order_relaxed))
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/// Maps a shared memory object as a channel.
+/// @param fd Descriptor of the shared memory object.
+/// @return Pointer to the mapped channel, `NULL` on error.
+static SharedChannel_t *map_channel(int fd) {
+  void *channel = mmap(NULL, sizeof(SharedChannel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (channel == MAP_FAILED) {
+    perror("Failed to map shared memory");
+    return NULL;
+  }
+  return (SharedChannel_t *)channel;
+}
+
+SharedChannel_t *create_channel(const char *name) {
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    perror("Failed to create shared memory");
+    return NULL;
+  }
+
+  // The new object is zero filled, which is an empty channel
+  if (ftruncate(fd, sizeof(SharedChannel_t)) < 0) {
+    perror("Failed to size shared memory");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  SharedChannel_t *channel = map_channel(fd);
+  if (channel == NULL) shm_unlink(name);
+  return channel;
+}
+
+SharedChannel_t *open_channel(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    perror("Failed to open shared memory");
+    return NULL;
+  }
+
+  // A smaller object would fault when accessed past its end
+  struct stat fd_stat;
+  if (fstat(fd, &fd_stat) < 0 || (size_t)fd_stat.st_size < sizeof(SharedChannel_t)) {
+    fprintf(stderr, "Invalid shared memory object\n");
+    close(fd);
+    return NULL;
+  }
+
+  return map_channel(fd);
+}
+
+void close_channel(SharedChannel_t *channel) { munmap(channel, sizeof(SharedChannel_t)); }
+
+ssize_t ring_read_some(Ring_t *ring, void *buf, size_t nbytes, int peer_fd) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head;
+
+  while ((head = atomic_load_explicit(&ring->head, memory_order_acquire)) == tail) {
+    if (ring_wait(&ring->head, tail, &ring->reader_waiting, peer_fd)) return -1;
+  }
+
+  // The producer may write anything to its counter, so it is not trusted to stay within the ring
+  if (head - tail > RING_CAPACITY) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  size_t available = head - tail;
+  if (available > nbytes) available = nbytes;
+
+  size_t offset = tail & (RING_CAPACITY - 1);
+  size_t first = available < RING_CAPACITY - offset ? available : RING_CAPACITY - offset;
+  memcpy(buf, ring->data + offset, first);
+  memcpy((char *)buf + first, ring->data, available - first);
+
+  atomic_store_explicit(&ring->tail, tail + (uint32_t)available, memory_order_release);
+  ring_wake(&ring->tail, &ring->writer_waiting);
+
+  return (ssize_t)available;
+}
+
+ssize_t ring_read(Ring_t *ring, void *buf, size_t nbytes, int peer_fd) {
+  size_t completed_bytes = 0;
+
+  while (completed_bytes < nbytes) {
+    ssize_t rd_bytes = ring_read_some(ring, (char *)buf + completed_bytes, nbytes - completed_bytes, peer_fd);
+    if (rd_bytes < 0) return -1;
+
+    completed_bytes += (size_t)rd_bytes;
+  }
+
+  return (ssize_t)completed_bytes;
+}
+
+ssize_t ring_write_some(Ring_t *ring, const void *buf, size_t nbytes, int peer_fd) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  // Same for the consumer's counter, an overfull ring would make the space wrap around
+  if (head - tail > RING_CAPACITY) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  size_t space = RING_CAPACITY - (head - tail);
+  if (space == 0 && peer_closed(peer_fd)) {
+    errno = EPIPE;
+    return -1;
+  }
+  if (space > nbytes) space = nbytes;
+
+  size_t offset = head & (RING_CAPACITY - 1);
+  size_t first = space < RING_CAPACITY - offset ? space : RING_CAPACITY - offset;
+  memcpy(ring->data + offset, buf, first);
+  memcpy(ring->data, (const char *)buf + first, space - first);
+
+  atomic_store_explicit(&ring->head, head + (uint32_t)space, memory_order_release);
+  ring_wake(&ring->head, &ring->reader_waiting);
+
+  return (ssize_t)space;
+}
+
+ssize_t ring_write(Ring_t *ring, const void *buf, size_t nbytes, int peer_fd) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t completed_bytes = 0;
+
+  while (completed_bytes < nbytes) {
+    uint32_t tail;
+    while (head - (tail = atomic_load_explicit(&ring->tail, memory_order_acquire)) == RING_CAPACITY) {
+      if (ring_wait(&ring->tail, tail, &ring->writer_waiting, peer_fd)) return -1;
+    }
+
+    ssize_t wr_bytes = ring_write_some(ring, (const char *)buf + completed_bytes, nbytes - completed_bytes, peer_fd);
+    if (wr_bytes < 0) return -1;
+
+    head += (uint32_t)wr_bytes;
+    completed_bytes += (size_t)wr_bytes;
+  }
+
+  return (ssize_t)completed_bytes;
+}
@@ -0,0 +1,75 @@
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RING_CAPACITY (1u << 18)  // Bytes of each ring, must be a power of two
+#define RING_SPIN_COUNT 1024      // Polls of the ring before going to sleep
+#define RING_WAIT_TIMEOUT_MS 100  // How often a sleeping side checks whether its peer is gone
+
+/// Single-producer/single-consumer byte stream placed in memory shared by two processes.
+/// The producer only sleeps when the ring is full and the consumer only when it is empty.
+typedef struct Ring {
+  _Alignas(64) _Atomic uint32_t head;  // Total bytes written, wraps around
+  _Atomic uint32_t reader_waiting;     // Whether the consumer sleeps on `head`
+  _Alignas(64) _Atomic uint32_t tail;  // Total bytes read, wraps around
+  _Atomic uint32_t writer_waiting;     // Whether the producer sleeps on `tail`
+  _Alignas(64) char data[RING_CAPACITY];
+} Ring_t;
+
+/// Shared memory region of a session. The client produces requests and the server responses.
+typedef struct SharedChannel {
+  Ring_t requests;
+  Ring_t responses;
+} SharedChannel_t;
+
+/// Creates a shared memory region holding an empty channel.
+/// @param name Name of the shared memory object, see `shm_open`.
+/// @return Pointer to the mapped channel, `NULL` on error.
+SharedChannel_t *create_channel(const char *name);
+
+/// Maps the channel created by the peer.
+/// @param name Name of the shared memory object, see `shm_open`.
+/// @return Pointer to the mapped channel, `NULL` on error.
+SharedChannel_t *open_channel(const char *name);
+
+/// Unmaps a channel.
+/// @param channel Channel to be unmapped.
+void close_channel(SharedChannel_t *channel);
+
+/// Reads the bytes available in the ring, waiting for at least one.
+/// @param ring Ring to read from.
+/// @param buf Buffer to hold read data.
+/// @param nbytes Maximum amount of data to read.
+/// @param peer_fd Descriptor that hangs up when the producer is gone.
+/// @return Number of bytes read, -1 with `errno` set to `EPIPE` if the producer is gone or left the ring inconsistent.
+ssize_t ring_read_some(Ring_t *ring, void *buf, size_t nbytes, int peer_fd);
+
+/// Reads exactly nbytes from the ring.
+/// @param ring Ring to read from.
+/// @param buf Buffer to hold read data.
+/// @param nbytes Amount of data to read.
+/// @param peer_fd Descriptor that hangs up when the producer is gone.
+/// @return nbytes, -1 with `errno` set to `EPIPE` if the producer is gone.
+ssize_t ring_read(Ring_t *ring, void *buf, size_t nbytes, int peer_fd);
+
+/// Writes as many bytes as the ring has space for, without waiting.
+/// @param ring Ring to write to.
+/// @param buf Buffer holding the data to write.
+/// @param nbytes Maximum amount of data to write.
+/// @param peer_fd Descriptor that hangs up when the consumer is gone.
+/// @return Number of bytes written, possibly 0, -1 with `errno` set to `EPIPE` if the consumer is gone or left the
+/// ring inconsistent.
+ssize_t ring_write_some(Ring_t *ring, const void *buf, size_t nbytes, int peer_fd);
+
+/// Writes nbytes to the ring, waiting for space when it is full.
+/// @param ring Ring to write to.
+/// @param buf Buffer holding the data to write.
+/// @param nbytes Amount of data to write.
+/// @param peer_fd Descriptor that hangs up when the consumer is gone.
+/// @return nbytes, -1 with `errno` set to `EPIPE` if the consumer is gone or left the ring inconsistent.
+ssize_t ring_write(Ring_t *ring, const void *buf, size_t nbytes, int peer_fd);
+
+#endif  // COMMON_RING_H
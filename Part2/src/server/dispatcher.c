@@ -0,0 +1,86 @@
+#include "dispatcher.h"
+
+#include <stdio.h>
+
+#include "sessions.h"
+
+/// Main function of the dispatcher's threads. Runs tasks until the dispatcher stops and no task is left.
+/// @param args Thread argument. A `Dispatcher_t` struct is passed as argument.
+/// @return `NULL`
+static void *run_tasks(void *args) {
+  Dispatcher_t *dispatcher = (Dispatcher_t *)args;
+
+  if (block_worker_signals()) return NULL;
+
+  pthread_mutex_lock(&dispatcher->tasks_lock);
+  while (1) {
+    while (dispatcher->front == NULL && !dispatcher->stopping)
+      pthread_cond_wait(&dispatcher->available_task, &dispatcher->tasks_lock);
+    if (dispatcher->front == NULL) break;
+
+    DispatchTask_t *task = dispatcher->front;
+    dispatcher->front = task->next;
+    if (dispatcher->front == NULL) dispatcher->rear = NULL;
+    pthread_mutex_unlock(&dispatcher->tasks_lock);
+
+    task->run(task->arg);
+
+    pthread_mutex_lock(&dispatcher->tasks_lock);
+  }
+  pthread_mutex_unlock(&dispatcher->tasks_lock);
+
+  return NULL;
+}
+
+int init_dispatcher(Dispatcher_t *dispatcher, unsigned int thread_count) {
+  dispatcher->front = dispatcher->rear = NULL;
+  dispatcher->stopping = 0;
+  dispatcher->thread_count = 0;
+
+  if (pthread_mutex_init(&dispatcher->tasks_lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize tasks lock\n");
+    return 1;
+  }
+
+  if (pthread_cond_init(&dispatcher->available_task, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize condition variable\n");
+    pthread_mutex_destroy(&dispatcher->tasks_lock);
+    return 1;
+  }
+
+  for (; dispatcher->thread_count < thread_count; dispatcher->thread_count++) {
+    if (pthread_create(&dispatcher->threads[dispatcher->thread_count], NULL, run_tasks, (void *)dispatcher) != 0) {
+      fprintf(stderr, "Failed to dispatch dispatcher thread\n");
+      free_dispatcher(dispatcher);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void dispatch_task(Dispatcher_t *dispatcher, DispatchTask_t *task) {
+  task->next = NULL;
+
+  pthread_mutex_lock(&dispatcher->tasks_lock);
+  if (dispatcher->rear == NULL)
+    dispatcher->front = task;
+  else
+    dispatcher->rear->next = task;
+  dispatcher->rear = task;
+  pthread_mutex_unlock(&dispatcher->tasks_lock);
+
+  pthread_cond_signal(&dispatcher->available_task);
+}
+
+void free_dispatcher(Dispatcher_t *dispatcher) {
+  pthread_mutex_lock(&dispatcher->tasks_lock);
+  dispatcher->stopping = 1;
+  pthread_mutex_unlock(&dispatcher->tasks_lock);
+  pthread_cond_broadcast(&dispatcher->available_task);
+
+  for (unsigned int i = 0; i < dispatcher->thread_count; i++) pthread_join(dispatcher->threads[i], NULL);
+
+  pthread_cond_destroy(&dispatcher->available_task);
+  pthread_mutex_destroy(&dispatcher->tasks_lock);
+}
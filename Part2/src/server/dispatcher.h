@@ -0,0 +1,41 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <pthread.h>
+
+#include "common/constants.h"
+
+/// Work handed to the dispatcher. Owned by whoever dispatches it, which must keep it alive until it has run.
+typedef struct DispatchTask {
+  void (*run)(void *arg);
+  void *arg;
+  struct DispatchTask *next;
+} DispatchTask_t;
+
+/// Pool of threads shared by every session, so that independent requests of one session run at the same time.
+typedef struct Dispatcher {
+  pthread_t threads[MAX_DISPATCH_THREADS];
+  unsigned int thread_count;
+  DispatchTask_t *front, *rear;  // Tasks waiting for a thread, oldest first
+  int stopping;
+  pthread_mutex_t tasks_lock;
+  pthread_cond_t available_task;
+} Dispatcher_t;
+
+/// Initializes the dispatcher and starts its threads.
+/// @param dispatcher Pointer to the dispatcher.
+/// @param thread_count Number of threads, at most `MAX_DISPATCH_THREADS`.
+/// @return 0 if successful, 1 otherwise.
+int init_dispatcher(Dispatcher_t *dispatcher, unsigned int thread_count);
+
+/// Queues a task to be run by one of the dispatcher's threads.
+/// @param dispatcher Pointer to the dispatcher.
+/// @param task Task to be run.
+void dispatch_task(Dispatcher_t *dispatcher, DispatchTask_t *task);
+
+/// Runs the tasks still queued, then stops the threads and frees all resources of the dispatcher.
+/// @note Must only be called once no more tasks can be dispatched.
+/// @param dispatcher Pointer to the dispatcher.
+void free_dispatcher(Dispatcher_t *dispatcher);
+
+#endif
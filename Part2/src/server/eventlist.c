@@ -1,76 +1,260 @@
 #include "eventlist.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+/// Hashes an event id. The top bits select the shard and the low bits the index slot.
+/// @param event_id Event id.
+/// @return Hash of the id.
+static uint32_t hash_id(unsigned int event_id) {
+  return (uint32_t)event_id * 2654435761u;  // Knuth's multiplicative hash
+}
+
+/// Computes the home slot of an event id in an index.
+/// @param event_id Event id.
+/// @param capacity Number of slots in the index (power of two).
+/// @return Index of the first slot to probe.
+static size_t index_slot(unsigned int event_id, size_t capacity) { return (size_t)hash_id(event_id) & (capacity - 1); }
+
+/// Allocates an empty index.
+/// @param capacity Number of slots (power of two).
+/// @return Newly created index, NULL on failure.
+static struct EventIndex* create_index(size_t capacity) {
+  struct EventIndex* index =
+      (struct EventIndex*)malloc(sizeof(struct EventIndex) + capacity * sizeof(_Atomic(struct Event*)));
+  if (!index) return NULL;
+
+  index->capacity = capacity;
+  index->retired = NULL;
+  for (size_t i = 0; i < capacity; i++) atomic_init(&index->slots[i], NULL);
+  return index;
+}
+
+/// Frees an index and every index it replaced.
+/// @param index Index to be freed.
+static void free_index(struct EventIndex* index) {
+  while (index) {
+    struct EventIndex* retired = index->retired;
+    free(index);
+    index = retired;
+  }
+}
+
+/// Inserts an event in an index using linear probing.
+/// @note The index must have at least one free slot. The release store publishes the event to readers.
+/// @param index Index to insert into.
+/// @param event Event to be inserted.
+static void index_insert(struct EventIndex* index, struct Event* event) {
+  size_t slot = index_slot(event->id, index->capacity);
+  while (atomic_load_explicit(&index->slots[slot], memory_order_relaxed) != NULL) {
+    slot = (slot + 1) & (index->capacity - 1);
+  }
+  atomic_store_explicit(&index->slots[slot], event, memory_order_release);
+}
+
+/// Replaces the shard's index with one twice as large. The old index is retired, not freed,
+/// since readers may still be probing it.
+/// @param shard Shard whose index is to be grown.
+/// @return 0 if the index was grown successfully, 1 otherwise.
+static int grow_index(struct EventShard* shard) {
+  struct EventIndex* old_index = atomic_load_explicit(&shard->index, memory_order_relaxed);
+  struct EventIndex* new_index = create_index(old_index->capacity * 2);
+  if (!new_index) return 1;
+
+  for (size_t i = 0; i < old_index->capacity; i++) {
+    struct Event* event = atomic_load_explicit(&old_index->slots[i], memory_order_relaxed);
+    if (event != NULL) index_insert(new_index, event);
+  }
+
+  new_index->retired = old_index;
+  atomic_store_explicit(&shard->index, new_index, memory_order_release);
+  return 0;
+}
+
+/// Frees the resources of the first `count` shards of a list.
+/// @param list Event list that owns the shards.
+/// @param count Number of shards to be freed.
+static void free_shards(struct EventList* list, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    pthread_mutex_destroy(&list->shards[i].mutex);
+    free_index(atomic_load_explicit(&list->shards[i].index, memory_order_relaxed));
+  }
+}
+
+struct Event* create_event(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  struct Event* event = (struct Event*)malloc(sizeof(struct Event));
+  if (!event) return NULL;
+
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  atomic_init(&event->reservations, 0);
+  atomic_init(&event->version, 1);
+  atomic_init(&event->writes_started, 0);
+  atomic_init(&event->writes_finished, 0);
+  atomic_init(&event->readers_waiting, 0);
+  atomic_init(&event->published, NULL);
+  atomic_init(&event->combining, 0);
+  atomic_init(&event->watchers, NULL);
+  atomic_init(&event->reserved, 0);
+
+  // Split the rows evenly over at most EVENT_MAX_STRIPES stripes, without empty stripes
+  size_t stripe_count = num_rows < EVENT_MAX_STRIPES ? num_rows : EVENT_MAX_STRIPES;
+  event->rows_per_stripe = num_rows == 0 ? 1 : (num_rows + stripe_count - 1) / stripe_count;
+  event->stripe_count = num_rows == 0 ? 1 : (num_rows + event->rows_per_stripe - 1) / event->rows_per_stripe;
+
+  event->data = calloc(num_rows * num_cols, sizeof(_Atomic(unsigned int)));
+  // Each row's tree has a leaf per block of FREE_RUN_BLOCK seats, rounded up to a power of two, and is stored as a
+  // heap: node 1 is the root and node n has children 2n and 2n + 1
+  event->free_run_leaves = 1;
+  while (event->free_run_leaves * FREE_RUN_BLOCK < num_cols) event->free_run_leaves *= 2;
+  event->free_runs = malloc(num_rows * 2 * event->free_run_leaves * sizeof(_Atomic(uint64_t)));
+  event->row_reserved = calloc(num_rows, sizeof(_Atomic(size_t)));
+  event->stripes = (pthread_mutex_t*)malloc(event->stripe_count * sizeof(pthread_mutex_t));
+  if (!event->data || !event->free_runs || !event->row_reserved || !event->stripes ||
+      pthread_mutex_init(&event->watchers_lock, NULL) != 0) {
+    free(event->data);
+    free(event->free_runs);
+    free(event->row_reserved);
+    free(event->stripes);
+    free(event);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < event->stripe_count; i++) {
+    if (pthread_mutex_init(&event->stripes[i], NULL) != 0) {
+      while (i-- > 0) pthread_mutex_destroy(&event->stripes[i]);
+      pthread_mutex_destroy(&event->watchers_lock);
+      free(event->data);
+      free(event->free_runs);
+      free(event->row_reserved);
+      free(event->stripes);
+      free(event);
+      return NULL;
+    }
+  }
+
+  return event;
+}
+
+void free_event(struct Event* event) {
+  if (!event) return;
+  for (size_t i = 0; i < event->stripe_count; i++) pthread_mutex_destroy(&event->stripes[i]);
+  pthread_mutex_destroy(&event->watchers_lock);
+  free(event->stripes);
+  free(event->free_runs);
+  free(event->row_reserved);
+  free(event->data);
+  free(event);
+}
+
 struct EventList* create_list() {
   struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
   if (!list) return NULL;
-  if (pthread_rwlock_init(&list->rwl, NULL) != 0) {
+  if (pthread_mutex_init(&list->mutex, NULL) != 0) {
     free(list);
     return NULL;
   }
-  list->head = NULL;
+
+  for (size_t i = 0; i < EVENT_SHARD_COUNT; i++) {
+    struct EventShard* shard = &list->shards[i];
+    struct EventIndex* index = create_index(EVENT_INDEX_INITIAL_CAPACITY);
+    if (!index || pthread_mutex_init(&shard->mutex, NULL) != 0) {
+      free(index);
+      free_shards(list, i);
+      pthread_mutex_destroy(&list->mutex);
+      free(list);
+      return NULL;
+    }
+    atomic_init(&shard->index, index);
+    shard->event_num = 0;
+  }
+
+  atomic_init(&list->head, NULL);
+  atomic_init(&list->event_num, 0);
   list->tail = NULL;
-  list->event_num = 0;
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
-  if (!list) return 1;
+struct EventShard* get_shard(struct EventList* list, unsigned int event_id) {
+  return &list->shards[hash_id(event_id) >> (32 - EVENT_SHARD_BITS)];
+}
+
+int insert_event(struct EventList* list, struct EventShard* shard, struct Event* event) {
+  if (!list || !shard) return 1;
+
+  // Keep the load factor of the index at or below 1/2 so probe sequences stay short
+  if ((shard->event_num + 1) * 2 > atomic_load_explicit(&shard->index, memory_order_relaxed)->capacity &&
+      grow_index(shard) != 0)
+    return 1;
 
   struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
   if (!new_node) return 1;
 
   new_node->event = event;
-  new_node->next = NULL;
+  atomic_init(&new_node->next, NULL);
 
-  if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
+  if (pthread_mutex_lock(&list->mutex) != 0) {
+    free(new_node);
+    return 1;
+  }
+
+  // Ids listed must be found, so the event is indexed before the release below publishes its node
+  index_insert(atomic_load_explicit(&shard->index, memory_order_relaxed), event);
+  shard->event_num++;
+
+  if (list->tail == NULL) {
+    atomic_store_explicit(&list->head, new_node, memory_order_release);
   } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
+    atomic_store_explicit(&list->tail->next, new_node, memory_order_release);
   }
-  list->event_num++;
+  list->tail = new_node;
+  // Readers only visit `event_num` nodes, so the node must be linked before it is counted
+  atomic_fetch_add_explicit(&list->event_num, 1, memory_order_release);
 
-  return 0;
-}
+  pthread_mutex_unlock(&list->mutex);
 
-static void free_event(struct Event* event) {
-  if (!event) return;
-  free(event->data);
-  free(event);
+  return 0;
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
+  struct ListNode* current = atomic_load_explicit(&list->head, memory_order_relaxed);
   while (current) {
     struct ListNode* temp = current;
-    current = current->next;
+    current = atomic_load_explicit(&current->next, memory_order_relaxed);
 
     free_event(temp->event);
     free(temp);
   }
 
+  free_shards(list, EVENT_SHARD_COUNT);
+  pthread_mutex_destroy(&list->mutex);
   free(list);
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  if (!list || !from || !to) return NULL;
-  struct ListNode* current = from;
+struct Event* get_event(struct EventShard* shard, unsigned int event_id) {
+  if (!shard) return NULL;
 
-  while (1) {
-    if (current->event->id == event_id) {
-      return current->event;
+  struct EventIndex* index = atomic_load_explicit(&shard->index, memory_order_acquire);
+  size_t slot = index_slot(event_id, index->capacity);
+  struct Event* event;
+  while ((event = atomic_load_explicit(&index->slots[slot], memory_order_acquire)) != NULL) {
+    if (event->id == event_id) {
+      return event;
     }
 
-    if (current == to) {
-      return NULL;
-    }
-
-    current = current->next;
+    slot = (slot + 1) & (index->capacity - 1);
   }
+
+  return NULL;
 }
+
+struct ListNode* list_head(struct EventList* list, size_t* event_num) {
+  *event_num = atomic_load_explicit(&list->event_num, memory_order_acquire);
+  return atomic_load_explicit(&list->head, memory_order_acquire);
+}
+
+struct ListNode* list_next(struct ListNode* node) { return atomic_load_explicit(&node->next, memory_order_acquire); }
@@ -2,53 +2,130 @@
 #define SERVER_EVENT_LIST_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_SHARD_BITS 4
+#define EVENT_SHARD_COUNT (1 << EVENT_SHARD_BITS)
+#define EVENT_INDEX_INITIAL_CAPACITY 16  // Must be a power of two
+#define EVENT_MAX_STRIPES 16             // Maximum number of row stripe locks per event
+#define FREE_RUN_BLOCK 32                // Seats of a row summarized by each leaf of its free-run tree
+
+struct PendingReservation;  // Reservation waiting to be applied by a combiner, see operations.c
+struct Watcher;             // Client told about every reservation of the event, see operations.h
 
 struct Event {
-  unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  unsigned int id;           /// Event id
+  atomic_uint reservations;  /// Number of reservations for the event.
+  atomic_uint version;       /// Bumped after every change to the seats, starting at 1.
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;     /// Array of size rows * cols with the reservations for each seat.
-  pthread_mutex_t mutex;  // Mutex to protect the event
+  _Atomic(unsigned int)* data;   /// Array of size rows * cols with the reservations for each seat.
+  atomic_uint writes_started;    /// Number of times writing to data began. Used as a sequence lock.
+  atomic_uint writes_finished;   /// Number of times writing to data ended. Used as a sequence lock.
+  atomic_uint readers_waiting;   /// Number of readers holding back new writes to data, see `read_seats`.
+  _Atomic(uint64_t)* free_runs;  /// Per row, segment tree of its runs of free seats. Filled in by operations.c.
+  size_t free_run_leaves;        /// Number of leaves of each row's free-run tree, a power of two.
+
+  atomic_size_t reserved;         /// Number of seats reserved.
+  _Atomic(size_t)* row_reserved;  /// Per row, number of seats reserved.
+
+  size_t rows_per_stripe;    /// Number of consecutive rows covered by each stripe.
+  size_t stripe_count;       /// Number of stripes.
+  pthread_mutex_t* stripes;  // Mutexes to protect each range of rows of the event
+
+  _Atomic(struct PendingReservation*) published;  // Reservations waiting for a combiner, newest first
+  atomic_int combining;                           // Whether a thread is applying the published reservations
+
+  _Atomic(struct Watcher*) watchers;  // Watchers of the event, `NULL` if none. Only changed with `watchers_lock` held
+  pthread_mutex_t watchers_lock;      // Held while watchers are added, removed or notified
 };
 
 struct ListNode {
   struct Event* event;
-  struct ListNode* next;
+  _Atomic(struct ListNode*) next;
+};
+
+// Open-addressing hash table of events keyed by id. Slots only ever go from NULL to an event.
+struct EventIndex {
+  size_t capacity;             // Number of slots (power of two)
+  struct EventIndex* retired;  // Older, smaller index this one replaced. Kept alive for lock-free readers.
+  _Atomic(struct Event*) slots[];
 };
 
-// Linked list structure
+// Slice of the event registry. Events are spread over the shards by hashing their id.
+// Readers probe the index without locking. Writers serialize on the shard mutex.
+struct EventShard {
+  _Atomic(struct EventIndex*) index;  // Current index of the shard's events
+  size_t event_num;                   // Number of events in the shard
+  pthread_mutex_t mutex;              // Mutex to serialize the shard's writers
+};
+
+// Append-only linked list structure. Readers traverse it without locking, visiting
+// at most `event_num` nodes. Writers serialize on the list mutex.
 struct EventList {
-  size_t event_num;
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t rwl;   // Mutex to protect the list
+  atomic_size_t event_num;
+  _Atomic(struct ListNode*) head;  // Head of the list
+  struct ListNode* tail;           // Tail of the list. Only used by writers.
+  pthread_mutex_t mutex;           // Mutex to serialize the list's writers
+  struct EventShard shards[EVENT_SHARD_COUNT];
 };
 
+/// Creates a new event with every seat free.
+/// @param event_id Event id.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @return Newly created event, NULL on failure.
+struct Event* create_event(unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Frees an event that was not inserted in a list.
+/// @param event Event to be freed.
+void free_event(struct Event* event);
+
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Gets the shard responsible for the given event id.
+/// @param list Event list that owns the shard.
+/// @param event_id Event id.
+/// @return Pointer to the shard.
+struct EventShard* get_shard(struct EventList* list, unsigned int event_id);
+
+/// Indexes an event in its shard and appends a new node with it to the list.
+/// @note The caller must hold the shard mutex and ensure no event with the same id exists.
+/// The event is published to lock-free readers, so it must be fully initialized.
 /// @param list Event list to be modified.
-/// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
-int append_to_list(struct EventList* list, struct Event* data);
+/// @param shard Shard returned by `get_shard` for the event's id.
+/// @param event Event to be stored.
+/// @return 0 if the event was stored successfully, 1 otherwise (the list is left unchanged).
+int insert_event(struct EventList* list, struct EventShard* shard, struct Event* event);
 
 /// Removes a node from the list.
 /// @param list Event list to be modified.
 /// @return 0 if the node was removed successfully, 1 otherwise.
 void free_list(struct EventList* list);
 
-/// Retrieves an event in the list.
-/// @param list Event list to be searched
+/// Retrieves an event from its shard's hash index.
+/// @note Does not lock. Events inserted concurrently may or may not be found.
+/// @param shard Shard returned by `get_shard` for the event id.
 /// @param event_id Event id.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to);
+struct Event* get_event(struct EventShard* shard, unsigned int event_id);
+
+/// Gets the first node of the list and how many nodes are safe to visit from it.
+/// @note Does not lock. Nodes appended concurrently are not counted.
+/// @param list Event list to be traversed.
+/// @param event_num Pointer to store the number of nodes that can be visited.
+/// @return First node of the list, NULL if the list is empty.
+struct ListNode* list_head(struct EventList* list, size_t* event_num);
+
+/// Gets the node that follows the given one.
+/// @param node Node obtained from `list_head` or `list_next`.
+/// @return Next node of the list.
+struct ListNode* list_next(struct ListNode* node);
 
 #endif  // SERVER_EVENT_LIST_H
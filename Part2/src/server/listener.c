@@ -0,0 +1,72 @@
+#include "listener.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sessions.h"
+
+#define LISTENER_BACKLOG 128
+
+int open_listener(Listener_t *listener, ConnectionQueue_t *queue, const char *socket_path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path is too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, socket_path);
+
+  listener->queue = queue;
+  listener->socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener->socket_fd < 0) {
+    perror("Failed to create socket");
+    return 1;
+  }
+
+  if (bind(listener->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    perror("Failed to bind socket");
+    close(listener->socket_fd);
+    return 1;
+  }
+
+  if (listen(listener->socket_fd, LISTENER_BACKLOG) < 0) {
+    perror("Failed to listen on socket");
+    close(listener->socket_fd);
+    unlink(socket_path);
+    return 1;
+  }
+
+  return 0;
+}
+
+void *accept_sockets(void *args) {
+  Listener_t *listener = (Listener_t *)args;
+
+  if (block_worker_signals()) return NULL;
+
+  while (1) {
+    int client_fd = accept(listener->socket_fd, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return NULL;  // The socket was shut down
+    }
+
+    if (enqueue_socket_connection(listener->queue, client_fd)) {
+      fprintf(stderr, "Failed adding new connection request to queue\n");
+      close(client_fd);
+    }
+  }
+}
+
+void shutdown_listener(Listener_t *listener) { shutdown(listener->socket_fd, SHUT_RDWR); }
+
+void close_listener(Listener_t *listener, const char *socket_path) {
+  close(listener->socket_fd);
+  if (unlink(socket_path) < 0) perror("Failed to unlink socket");
+}
@@ -0,0 +1,34 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include "queue.h"
+
+typedef struct Listener {
+  ConnectionQueue_t *queue;
+  int socket_fd;  // Listening Unix domain socket
+} Listener_t;
+
+/// Creates a Unix domain socket and listens for clients on it.
+/// @param listener Pointer to the listener.
+/// @param queue Connection queue accepted clients are added to.
+/// @param socket_path Path to bind the socket to.
+/// @return 0 if successful, 1 otherwise.
+int open_listener(Listener_t *listener, ConnectionQueue_t *queue, const char *socket_path);
+
+/// Main function of the listener thread. Accepts clients and adds them to the connection queue.
+/// Returns after `close_listener` is called.
+/// @param args Thread argument. A `Listener_t` struct is passed as argument.
+/// @return `NULL`
+void *accept_sockets(void *args);
+
+/// Stops accepting clients and wakes up the listener thread.
+/// @param listener Pointer to the listener.
+void shutdown_listener(Listener_t *listener);
+
+/// Closes and unlinks the socket.
+/// @note Must only be called after the listener thread has returned.
+/// @param listener Pointer to the listener.
+/// @param socket_path Path the socket was bound to.
+void close_listener(Listener_t *listener, const char *socket_path);
+
+#endif
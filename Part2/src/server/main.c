@@ -10,6 +10,10 @@
 
 #include "common/constants.h"
 #include "common/io.h"
+#include "dispatcher.h"
+#include "listener.h"
+#include "multiplexer.h"
+#include "notifier.h"
 #include "operations.h"
 #include "queue.h"
 #include "sessions.h"
@@ -25,6 +29,14 @@ void sig_handler(int sig) {
     usr1_sig = 1;
 }
 
+/// Prints the server's command line syntax.
+/// @param program Name of the server executable.
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-r mutex|cas|combine] [-e pollers] [-p dispatchers] [-s socket_path] <pipe_path> [delay]\n",
+          program);
+}
+
 int main(int argc, char* argv[]) {
   struct sigaction sa;
   sa.sa_handler = &sig_handler;
@@ -32,12 +44,63 @@ int main(int argc, char* argv[]) {
   sigaction(SIGINT, &sa, NULL);
   sigaction(SIGUSR1, &sa, NULL);
 
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "Usage: %s\n <pipe_path> [delay]\n", argv[0]);
+  char* endptr;
+  enum ReserveMode reserve_mode = RESERVE_MUTEX;
+  unsigned int poller_count = 0;
+  unsigned int dispatcher_count = 0;
+  const char* socket_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:e:p:s:")) != -1) {
+    switch (opt) {
+      case 'r':
+        if (strcmp(optarg, "mutex") == 0)
+          reserve_mode = RESERVE_MUTEX;
+        else if (strcmp(optarg, "cas") == 0)
+          reserve_mode = RESERVE_CAS;
+        else if (strcmp(optarg, "combine") == 0)
+          reserve_mode = RESERVE_COMBINE;
+        else {
+          fprintf(stderr, "Invalid reservation mode: %s\n", optarg);
+          return 1;
+        }
+        break;
+
+      case 'e': {
+        unsigned long int pollers = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || pollers == 0 || pollers > MAX_POLLER_COUNT) {
+          fprintf(stderr, "Invalid number of pollers (1 to %d)\n", MAX_POLLER_COUNT);
+          return 1;
+        }
+        poller_count = (unsigned int)pollers;
+        break;
+      }
+
+      case 'p': {
+        unsigned long int dispatchers = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || dispatchers == 0 || dispatchers > MAX_DISPATCH_THREADS) {
+          fprintf(stderr, "Invalid number of dispatcher threads (1 to %d)\n", MAX_DISPATCH_THREADS);
+          return 1;
+        }
+        dispatcher_count = (unsigned int)dispatchers;
+        break;
+      }
+
+      case 's':
+        socket_path = optarg;
+        break;
+
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind < 1 || argc - optind > 2) {
+    print_usage(argv[0]);
     return 1;
   }
+  argc -= optind - 1;
+  argv += optind - 1;
 
-  char* endptr;
   unsigned int state_access_delay_us = STATE_ACCESS_DELAY_US;
   if (argc == 3) {
     unsigned long int delay = strtoul(argv[2], &endptr, 10);
@@ -57,7 +120,7 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  if (ems_init(state_access_delay_us)) {
+  if (ems_init(state_access_delay_us, reserve_mode)) {
     if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
 
     return 1;
@@ -71,14 +134,57 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  pthread_t worker_threads[MAX_SESSION_COUNT];
+  // Requests of a session on different events run on the dispatcher at the same time
+  Dispatcher_t dispatcher;
+  Dispatcher_t *session_dispatcher = dispatcher_count ? &dispatcher : NULL;
+  if (dispatcher_count && init_dispatcher(&dispatcher, dispatcher_count) != 0) {
+    if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
+
+    ems_terminate();
+    free_queue(&connect_queue);
+    return 1;
+  }
+
+  // Reservations of watched events are pushed to the sessions watching them by the notifier's threads
+  Notifier_t notifier;
+  if (init_notifier(&notifier) != 0) {
+    if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
+
+    if (dispatcher_count) free_dispatcher(&dispatcher);
+    ems_terminate();
+    free_queue(&connect_queue);
+    return 1;
+  }
+
+  // Event-driven mode runs one acceptor and `poller_count` pollers instead of one worker per session
+  unsigned int thread_count = poller_count ? poller_count + 1 : MAX_SESSION_COUNT;
+  pthread_t worker_threads[MAX_POLLER_COUNT + 1 > MAX_SESSION_COUNT ? MAX_POLLER_COUNT + 1 : MAX_SESSION_COUNT];
   Session_t sessions[MAX_SESSION_COUNT];
+  Multiplexer_t mux;
+
+  if (poller_count && init_multiplexer(&mux, &connect_queue, session_dispatcher, &notifier) != 0) {
+    if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
+
+    free_notifier(&notifier);
+    if (dispatcher_count) free_dispatcher(&dispatcher);
+    ems_terminate();
+    free_queue(&connect_queue);
+    return 1;
+  }
 
-  for (unsigned int i = 0; i < MAX_SESSION_COUNT; i++) {
-    sessions[i].session_id = i;
-    sessions[i].queue = &connect_queue;
+  for (unsigned int i = 0; i < thread_count; i++) {
+    int create_status;
+    if (poller_count) {
+      create_status = pthread_create(&worker_threads[i], NULL, i == 0 ? accept_clients : poll_clients, (void*)&mux);
+    } else {
+      sessions[i].session_id = i;
+      sessions[i].queue = &connect_queue;
+      sessions[i].dispatcher = session_dispatcher;
+      sessions[i].notifier = &notifier;
+      create_status = pthread_create(&worker_threads[i], NULL, connect_clients, (void*)&sessions[i]);
+    }
 
-    if (pthread_create(&worker_threads[i], NULL, connect_clients, (void*)&sessions[i]) != 0) {
+    if (create_status != 0) {
       if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
 
       fprintf(stderr, "Failed to dispatch worker thread\n");
@@ -98,6 +204,28 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  Listener_t listener;
+  pthread_t listener_thread;
+  if (socket_path != NULL && open_listener(&listener, &connect_queue, socket_path) != 0) {
+    if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
+
+    close(register_pipe);
+    ems_terminate();
+    free_queue(&connect_queue);
+    return 1;
+  }
+
+  if (socket_path != NULL && pthread_create(&listener_thread, NULL, accept_sockets, (void*)&listener) != 0) {
+    if (unlink(reg_pipe_path) < 0) perror("Failed to unlink register pipe");
+
+    fprintf(stderr, "Failed to dispatch listener thread\n");
+    close_listener(&listener, socket_path);
+    close(register_pipe);
+    ems_terminate();
+    free_queue(&connect_queue);
+    return 1;
+  }
+
   ssize_t read_status = 0;
   while (1) {
     if (terminate) break;
@@ -123,16 +251,28 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (socket_path != NULL) {
+    shutdown_listener(&listener);
+    pthread_join(listener_thread, NULL);
+    close_listener(&listener, socket_path);
+  }
+
   pthread_rwlock_wrlock(&connect_queue.termination_lock);
   connect_queue.terminate = 1;
   pthread_rwlock_unlock(&connect_queue.termination_lock);
   pthread_cond_broadcast(&connect_queue.available_connection);
 
-  for (unsigned int i = 0; i < MAX_SESSION_COUNT; i++) {
+  if (poller_count) stop_multiplexer(&mux);
+
+  for (unsigned int i = 0; i < thread_count; i++) {
     pthread_join(worker_threads[i], NULL);
     fprintf(stdout, "\x1b[1;94m[WORKER %.2u]: Terminated!\x1b[0m\n", i);
   }
 
+  if (poller_count) free_multiplexer(&mux);
+  free_notifier(&notifier);
+  if (dispatcher_count) free_dispatcher(&dispatcher);
+
   close(register_pipe);
   unlink(reg_pipe_path);
   free_queue(&connect_queue);
@@ -0,0 +1,294 @@
+#include "multiplexer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sessions.h"
+
+/// Session served by the multiplexer. At any time it is either waiting to be set up, watched for requests, watched for
+/// room for responses or run by a worker, and only whoever holds it then touches it.
+typedef struct MuxSession {
+  ClientSession_t client;
+  Multiplexer_t *mux;
+  Connection_t *connection;  // Connection request until the session is set up
+  struct timespec accepted;  // When the connection request was taken, on the monotonic clock
+  DispatchTask_t task;       // Runs the requests read on a worker
+  int writing;               // Whether the session waits for room for its responses rather than for requests
+  int status;                // Status of the session once its responses are sent
+  struct MuxSession *prev, *next;
+} MuxSession_t;
+
+int init_multiplexer(Multiplexer_t *mux, ConnectionQueue_t *queue, Dispatcher_t *dispatcher, Notifier_t *notifier) {
+  mux->queue = queue;
+  mux->dispatcher = dispatcher;
+  mux->notifier = notifier;
+  mux->next_session_id = 0;
+  mux->sessions = NULL;
+
+  if (pthread_mutex_init(&mux->sessions_lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize sessions lock\n");
+    return 1;
+  }
+
+  mux->epoll_fd = epoll_create1(0);
+  if (mux->epoll_fd < 0) {
+    perror("Failed to create epoll instance");
+    pthread_mutex_destroy(&mux->sessions_lock);
+    return 1;
+  }
+
+  mux->wake_fd = eventfd(0, 0);
+  if (mux->wake_fd < 0) {
+    perror("Failed to create wake up event");
+    close(mux->epoll_fd);
+    pthread_mutex_destroy(&mux->sessions_lock);
+    return 1;
+  }
+
+  // Level triggered and never rearmed, so every poller sees it
+  struct epoll_event wake_event = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(mux->epoll_fd, EPOLL_CTL_ADD, mux->wake_fd, &wake_event) < 0) {
+    perror("Failed to watch wake up event");
+    close(mux->wake_fd);
+    close(mux->epoll_fd);
+    pthread_mutex_destroy(&mux->sessions_lock);
+    return 1;
+  }
+
+  if (init_dispatcher(&mux->workers, MUX_WORKER_COUNT) != 0) {
+    close(mux->wake_fd);
+    close(mux->epoll_fd);
+    pthread_mutex_destroy(&mux->sessions_lock);
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Closes a session and forgets about it.
+/// @param mux Pointer to the multiplexer.
+/// @param session Session to be closed.
+static void remove_session(Multiplexer_t *mux, MuxSession_t *session) {
+  pthread_mutex_lock(&mux->sessions_lock);
+  if (session->prev)
+    session->prev->next = session->next;
+  else
+    mux->sessions = session->next;
+  if (session->next) session->next->prev = session->prev;
+  pthread_mutex_unlock(&mux->sessions_lock);
+
+  close_session(&session->client);
+  free(session);
+}
+
+/// Closes a session that is done and reports why.
+/// @param mux Pointer to the multiplexer.
+/// @param session Session to be closed.
+/// @param status Status of the session, other than `CLIENT_PENDING`.
+static void end_session(Multiplexer_t *mux, MuxSession_t *session, int status) {
+  unsigned int session_id = session->client.session_id;
+  remove_session(mux, session);
+
+  if (status == CLIENT_FAILED)
+    fprintf(stderr, "Failed communicating with client\n");
+  else if (status == CLIENT_UNRESPONSIVE)
+    fprintf(stderr, "\x1b[1;91m[SESSION %.2u] Client is unresponsive. Terminating Session...\x1b[0m\n", session_id);
+  else
+    fprintf(stdout, "\x1b[1;94m[SESSION %.2u] Job successfully completed. Terminating Session...\x1b[0m\n",
+            session_id);
+}
+
+/// Watches one of the session's descriptors once more, giving the session up to the poller that sees it ready.
+/// @param mux Pointer to the multiplexer.
+/// @param session Session to be watched.
+/// @param writing Whether to watch for room for responses rather than for requests.
+/// @return 0 if successful, 1 otherwise.
+static int watch_session(Multiplexer_t *mux, MuxSession_t *session, int writing) {
+  session->writing = writing;
+  int fd = writing ? session->client.resp_fd : session->client.req_fd;
+
+  // One shot, so that only one poller at a time handles the session. The response descriptor is only added the
+  // first time the client runs out of room
+  struct epoll_event event = {.events = (writing ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT, .data.ptr = session};
+  if (epoll_ctl(mux->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) return 0;
+  if (errno == ENOENT && epoll_ctl(mux->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) return 0;
+
+  perror(writing ? "Failed to watch response pipe" : "Failed to watch request pipe");
+  return 1;
+}
+
+/// Sends what the client can take of the session's responses, then watches the session for requests, or for room
+/// for the rest of its responses. Sessions that are done are closed once their responses are sent.
+/// @param mux Pointer to the multiplexer.
+/// @param session Session to be resumed.
+/// @param status Status of the session.
+static void resume_session(Multiplexer_t *mux, MuxSession_t *session, int status) {
+  if (status == CLIENT_PENDING || status == CLIENT_SUCCESS) {
+    int output_status = flush_responses(&session->client);
+    if (output_status == CLIENT_PENDING) {
+      session->status = status;
+      if (watch_session(mux, session, 1) == 0) return;
+      output_status = CLIENT_FAILED;
+    }
+    if (output_status != CLIENT_SUCCESS) status = output_status;
+  }
+
+  if (status == CLIENT_PENDING && watch_session(mux, session, 0) == 0) return;
+  end_session(mux, session, status == CLIENT_PENDING ? CLIENT_FAILED : status);
+}
+
+/// Executes the requests read from a session, then resumes it. Worker task.
+/// @param arg Session with requests to execute.
+static void serve_session(void *arg) {
+  MuxSession_t *session = (MuxSession_t *)arg;
+  resume_session(session->mux, session, serve_requests(&session->client));
+}
+
+/// Gives up on a client that never got ready to be set up.
+/// @param session Session waiting to be set up.
+static void drop_pending_session(MuxSession_t *session) {
+  if (session->connection->socket_fd >= 0) close(session->connection->socket_fd);
+  free(session->connection);
+  free(session);
+}
+
+/// Tries to set up the sessions whose clients were not ready, then hands those that are to the pollers.
+/// @param mux Pointer to the multiplexer.
+/// @param pending List of sessions waiting to be set up, linked through `next`. Updated with those still waiting.
+static void open_pending_sessions(Multiplexer_t *mux, MuxSession_t **pending) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  MuxSession_t **link = pending;
+  while (*link != NULL) {
+    MuxSession_t *session = *link;
+    int open_status = open_session(&session->client, session->connection, session->client.session_id, 1,
+                                   mux->dispatcher, mux->notifier);
+
+    long waited_ms =
+        (now.tv_sec - session->accepted.tv_sec) * 1000L + (now.tv_nsec - session->accepted.tv_nsec) / 1000000L;
+    if (open_status == CLIENT_PENDING && waited_ms < SETUP_TIMEOUT_MS) {
+      link = &session->next;
+      continue;
+    }
+
+    *link = session->next;
+    if (open_status == CLIENT_PENDING)
+      fprintf(stderr, "Client did not get ready to be set up\n");
+    else if (open_status)
+      session->connection->socket_fd = -1;  // Already closed by `open_session`
+    if (open_status) {
+      drop_pending_session(session);
+      continue;
+    }
+    free(session->connection);
+    session->connection = NULL;
+
+    pthread_mutex_lock(&mux->sessions_lock);
+    session->prev = NULL;
+    session->next = mux->sessions;
+    if (mux->sessions) mux->sessions->prev = session;
+    mux->sessions = session;
+    pthread_mutex_unlock(&mux->sessions_lock);
+
+    if (watch_session(mux, session, 0)) {
+      remove_session(mux, session);
+      continue;
+    }
+
+    fprintf(stdout, "\x1b[1;94m[SESSION %.2u] Connected to Client!\x1b[0m\n", session->client.session_id);
+  }
+}
+
+void *accept_clients(void *args) {
+  Multiplexer_t *mux = (Multiplexer_t *)args;
+
+  if (block_worker_signals()) return NULL;
+
+  // Clients are only waited for through the queue, so that one that is slow to open its pipes holds up no other
+  MuxSession_t *pending = NULL;
+  while (!check_termination(mux->queue)) {
+    Connection_t *connection = wait_connection(mux->queue, pending != NULL ? MUX_SETUP_RETRY_MS : -1);
+    if (connection != NULL) {
+      MuxSession_t *session = (MuxSession_t *)malloc(sizeof(MuxSession_t));
+      if (session == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        if (connection->socket_fd >= 0) close(connection->socket_fd);
+        free(connection);
+        continue;
+      }
+
+      session->mux = mux;
+      session->connection = connection;
+      session->client.session_id = mux->next_session_id++;
+      clock_gettime(CLOCK_MONOTONIC, &session->accepted);
+      session->next = pending;
+      pending = session;
+    }
+
+    open_pending_sessions(mux, &pending);
+  }
+
+  while (pending != NULL) {
+    MuxSession_t *session = pending;
+    pending = session->next;
+    drop_pending_session(session);
+  }
+
+  return NULL;
+}
+
+void *poll_clients(void *args) {
+  Multiplexer_t *mux = (Multiplexer_t *)args;
+  struct epoll_event events[MUX_MAX_EVENTS];
+
+  if (block_worker_signals()) return NULL;
+
+  while (1) {
+    int ready = epoll_wait(mux->epoll_fd, events, MUX_MAX_EVENTS, -1);
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      perror("Failed waiting for requests");
+      return NULL;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      MuxSession_t *session = (MuxSession_t *)events[i].data.ptr;
+      if (session == NULL) return NULL;
+
+      if (session->writing) {
+        resume_session(mux, session, session->status);
+        continue;
+      }
+
+      // Requests are executed by a worker, which watches the session again once they are answered
+      int job_status = read_requests(&session->client);
+      if (job_status == CLIENT_PENDING && request_ready(&session->client)) {
+        session->task = (DispatchTask_t){.run = serve_session, .arg = session};
+        dispatch_task(&mux->workers, &session->task);
+        continue;
+      }
+      resume_session(mux, session, job_status);
+    }
+  }
+}
+
+void stop_multiplexer(Multiplexer_t *mux) {
+  uint64_t wake = 1;
+  if (write(mux->wake_fd, &wake, sizeof(wake)) < 0) perror("Failed to wake up pollers");
+}
+
+void free_multiplexer(Multiplexer_t *mux) {
+  free_dispatcher(&mux->workers);
+  while (mux->sessions) remove_session(mux, mux->sessions);
+
+  close(mux->wake_fd);
+  close(mux->epoll_fd);
+  pthread_mutex_destroy(&mux->sessions_lock);
+}
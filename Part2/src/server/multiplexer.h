@@ -0,0 +1,62 @@
+#ifndef MULTIPLEXER_H
+#define MULTIPLEXER_H
+
+#include <pthread.h>
+
+#include "dispatcher.h"
+#include "notifier.h"
+#include "queue.h"
+
+#define MUX_MAX_EVENTS 64                   // Maximum number of ready sessions taken by a poller at once
+#define MUX_WORKER_COUNT MAX_SESSION_COUNT  // Threads executing requests, as many as serve sessions without pollers
+#define MUX_SETUP_RETRY_MS 5                // How often clients that were not ready are tried again
+
+struct MuxSession;
+
+/// Event-driven alternative to one worker thread per client. An acceptor thread opens the
+/// pipes of new clients and a few poller threads serve every open session through epoll.
+/// Pollers only read requests and write queued responses, the requests are executed by the workers.
+typedef struct Multiplexer {
+  ConnectionQueue_t *queue;
+  Dispatcher_t *dispatcher;     // Handed to every session, may be `NULL`
+  Dispatcher_t workers;         // Executes the requests read by the pollers
+  Notifier_t *notifier;         // Handed to every session
+  int epoll_fd;
+  int wake_fd;                  // Becomes readable when the pollers must stop
+  unsigned int next_session_id;
+  struct MuxSession *sessions;  // Open sessions
+  pthread_mutex_t sessions_lock;
+} Multiplexer_t;
+
+/// Initializes the multiplexer.
+/// @param mux Pointer to the multiplexer.
+/// @param queue Connection queue the acceptor takes new clients from.
+/// @param dispatcher Dispatcher of the sessions, `NULL` if they execute their requests in order.
+/// @param notifier Notifier of the sessions.
+/// @return 0 if successful, 1 otherwise.
+int init_multiplexer(Multiplexer_t *mux, ConnectionQueue_t *queue, Dispatcher_t *dispatcher, Notifier_t *notifier);
+
+/// Main function of the acceptor thread. Opens a session for each connection request and
+/// hands it to the pollers. Clients that are not ready are tried again until `SETUP_TIMEOUT_MS`
+/// has passed, without waiting for them. Returns when the connection queue is terminated.
+/// @param args Thread argument. A `Multiplexer_t` struct is passed as argument.
+/// @return `NULL`
+void *accept_clients(void *args);
+
+/// Main function of the poller threads. Reads the requests of sessions as they arrive and hands
+/// them to the workers, and sends responses the clients could not take once they have room.
+/// Returns after `stop_multiplexer` is called.
+/// @param args Thread argument. A `Multiplexer_t` struct is passed as argument.
+/// @return `NULL`
+void *poll_clients(void *args);
+
+/// Wakes up every poller thread and makes it return.
+/// @param mux Pointer to the multiplexer.
+void stop_multiplexer(Multiplexer_t *mux);
+
+/// Waits for the workers, then closes every open session and frees all resources of the multiplexer.
+/// @note Must only be called after every acceptor and poller thread has returned.
+/// @param mux Pointer to the multiplexer.
+void free_multiplexer(Multiplexer_t *mux);
+
+#endif
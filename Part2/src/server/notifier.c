@@ -0,0 +1,383 @@
+#include "notifier.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sessions.h"
+
+/// Encodes a push frame.
+/// @param frame Buffer of at least `PUSH_HEADER_SIZE` plus 4 bytes per seat to encode the frame in.
+/// @param event_id Id of the event.
+/// @param reservation_id Id of the reservation.
+/// @param num_seats Number of seats reserved, 0 if the pushes after the reservation were dropped.
+/// @param seats Indexes of the seats reserved.
+/// @return Size of the frame.
+static size_t encode_push(char *frame, unsigned int event_id, unsigned int reservation_id, size_t num_seats,
+                          const size_t *seats) {
+  size_t frame_size = PUSH_HEADER_SIZE + num_seats * sizeof(uint32_t);
+  uint32_t header[5] = {(uint32_t)(frame_size - FRAME_HEADER_SIZE), PUSH_REQUEST_ID, event_id, reservation_id,
+                        (uint32_t)num_seats};
+  memcpy(frame, header, sizeof(header));
+  frame += sizeof(header);
+
+  for (size_t i = 0; i < num_seats; i++, frame += sizeof(uint32_t)) {
+    uint32_t seat = (uint32_t)seats[i];
+    memcpy(frame, &seat, sizeof(uint32_t));
+  }
+
+  int status = 0;
+  memcpy(frame, &status, sizeof(int));
+  return frame_size;
+}
+
+/// Queues a subscriber on the notifier, unless it already is or is being pushed to.
+/// @note The caller must hold the subscriber's lock.
+/// @param subscriber Subscriber with pushes waiting.
+static void schedule_subscriber(Subscriber_t *subscriber) {
+  Notifier_t *notifier = subscriber->notifier;
+  if (subscriber->scheduled) return;
+  subscriber->scheduled = 1;
+
+  pthread_mutex_lock(&notifier->lock);
+  subscriber->next = NULL;
+  if (notifier->rear == NULL)
+    notifier->front = subscriber;
+  else
+    notifier->rear->next = subscriber;
+  notifier->rear = subscriber;
+  pthread_mutex_unlock(&notifier->lock);
+
+  pthread_cond_signal(&notifier->scheduled);
+}
+
+/// Queues the push of a reservation for the subscriber of a watcher. Called by `ems_reserve`, see `Watcher_t`.
+/// @param watcher Watcher of the subscriber.
+/// @param reservation_id Id of the reservation.
+/// @param num_seats Number of seats reserved.
+/// @param seats Sorted indexes of the seats reserved.
+static void queue_push(Watcher_t *watcher, unsigned int reservation_id, size_t num_seats, const size_t *seats) {
+  Subscriber_t *subscriber = (Subscriber_t *)watcher->ctx;
+  size_t slot = (size_t)(watcher - subscriber->watchers);
+  size_t frame_size = PUSH_HEADER_SIZE + num_seats * sizeof(uint32_t);
+
+  pthread_mutex_lock(&subscriber->lock);
+  if (subscriber->gone) {
+    pthread_mutex_unlock(&subscriber->lock);
+    return;
+  }
+
+  // Once a push of the event is dropped the later ones are too, the client catches up on all of them at once
+  unsigned int *first_lost = &subscriber->first_lost[slot];
+  if (*first_lost != 0 || subscriber->buffered + frame_size > SUBSCRIBER_BUFFER_SIZE) {
+    if (*first_lost == 0 || reservation_id < *first_lost) *first_lost = reservation_id;
+  } else {
+    subscriber->buffered +=
+        encode_push(subscriber->buffer + subscriber->buffered, watcher->event_id, reservation_id, num_seats, seats);
+  }
+
+  schedule_subscriber(subscriber);
+  pthread_mutex_unlock(&subscriber->lock);
+}
+
+/// Takes every push waiting for a subscriber, adding one for each event whose pushes were dropped.
+/// @param subscriber Subscriber being pushed to.
+/// @param frames Buffer of `SUBSCRIBER_FRAMES_SIZE` bytes to store them in.
+/// @return Size of the push frames taken, 0 if there are none or the client is gone.
+static size_t take_pushes(Subscriber_t *subscriber, char *frames) {
+  pthread_mutex_lock(&subscriber->lock);
+  size_t size = subscriber->gone ? 0 : subscriber->buffered;
+  memcpy(frames, subscriber->buffer, size);
+  subscriber->buffered = 0;
+
+  for (size_t slot = 0; slot < WATCH_MAX_EVENTS; slot++) {
+    unsigned int first_lost = subscriber->first_lost[slot];
+    if (first_lost == 0) continue;
+
+    subscriber->first_lost[slot] = 0;
+    if (!subscriber->gone)
+      size += encode_push(frames + size, subscriber->watchers[slot].event_id, first_lost - 1, 0, NULL);
+  }
+  pthread_mutex_unlock(&subscriber->lock);
+
+  return size;
+}
+
+/// Checks whether pushes are waiting for a subscriber.
+/// @note The caller must hold the subscriber's lock.
+/// @param subscriber Subscriber to check.
+/// @return 1 if there are, 0 otherwise.
+static int has_pushes(const Subscriber_t *subscriber) {
+  if (subscriber->buffered > 0) return 1;
+  for (size_t slot = 0; slot < WATCH_MAX_EVENTS; slot++) {
+    if (subscriber->first_lost[slot] != 0) return 1;
+  }
+  return 0;
+}
+
+/// Queues the stalled subscribers of the notifier again once their retry time has come.
+/// @note The caller must hold the notifier's lock.
+/// @param notifier Pointer to the notifier.
+static void retry_stalled(Notifier_t *notifier) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (notifier->stalled == NULL || now.tv_sec < notifier->retry_at.tv_sec ||
+      (now.tv_sec == notifier->retry_at.tv_sec && now.tv_nsec < notifier->retry_at.tv_nsec))
+    return;
+
+  Subscriber_t *last = notifier->stalled;
+  while (last->next != NULL) last = last->next;
+  if (notifier->rear == NULL)
+    notifier->front = notifier->stalled;
+  else
+    notifier->rear->next = notifier->stalled;
+  notifier->rear = last;
+  notifier->stalled = NULL;
+}
+
+/// Sets a subscriber aside until `PUSH_RETRY_MS` after the first stalled subscriber, so that a client which does not
+/// read is not tried again right away.
+/// @note The caller must hold the notifier's lock.
+/// @param subscriber Subscriber whose client did not take all of its pushes.
+static void stall_subscriber(Subscriber_t *subscriber) {
+  Notifier_t *notifier = subscriber->notifier;
+
+  if (notifier->stalled == NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &notifier->retry_at);
+    notifier->retry_at.tv_nsec += PUSH_RETRY_MS * 1000000L;
+    if (notifier->retry_at.tv_nsec >= 1000000000L) {
+      notifier->retry_at.tv_sec++;
+      notifier->retry_at.tv_nsec -= 1000000000L;
+    }
+  }
+
+  subscriber->next = notifier->stalled;
+  notifier->stalled = subscriber;
+}
+
+/// Main function of the notifier's threads. Sends the waiting pushes of queued subscribers until the notifier stops.
+/// @param args Thread argument. A `Notifier_t` struct is passed as argument.
+/// @return `NULL`
+static void *push_changes(void *args) {
+  Notifier_t *notifier = (Notifier_t *)args;
+
+  if (block_worker_signals()) return NULL;
+
+  pthread_mutex_lock(&notifier->lock);
+  while (1) {
+    retry_stalled(notifier);
+    while (notifier->front == NULL && !notifier->stopping) {
+      if (notifier->stalled == NULL)
+        pthread_cond_wait(&notifier->scheduled, &notifier->lock);
+      else if (pthread_cond_timedwait(&notifier->scheduled, &notifier->lock, &notifier->retry_at) == ETIMEDOUT)
+        retry_stalled(notifier);
+    }
+    if (notifier->front == NULL) break;
+
+    Subscriber_t *subscriber = notifier->front;
+    notifier->front = subscriber->next;
+    if (notifier->front == NULL) notifier->rear = NULL;
+    subscriber->pushing = 1;
+    pthread_mutex_unlock(&notifier->lock);
+
+    // Reserving threads only wait for the copy, never for the client. New pushes are only taken once the client
+    // took the previous ones, until then they pile up in the buffer
+    if (subscriber->unsent == 0) subscriber->unsent = take_pushes(subscriber, subscriber->frames);
+    ssize_t taken = 0;
+    if (subscriber->unsent > 0) taken = subscriber->send(subscriber->ctx, subscriber->frames, subscriber->unsent);
+    if (taken > 0) {
+      subscriber->unsent -= (size_t)taken;
+      memmove(subscriber->frames, subscriber->frames + taken, subscriber->unsent);
+    }
+
+    // Still scheduled while pushing or stalled, so no other thread sends its pushes out of order
+    pthread_mutex_lock(&subscriber->lock);
+    if (taken < 0) subscriber->gone = 1;
+    pthread_mutex_lock(&notifier->lock);
+    subscriber->pushing = 0;
+    pthread_cond_broadcast(&notifier->pushed);
+    if (subscriber->gone) {
+      subscriber->scheduled = 0;
+    } else if (subscriber->unsent > 0) {
+      stall_subscriber(subscriber);
+    } else if (has_pushes(subscriber)) {
+      subscriber->next = NULL;
+      if (notifier->rear == NULL)
+        notifier->front = subscriber;
+      else
+        notifier->rear->next = subscriber;
+      notifier->rear = subscriber;
+    } else {
+      subscriber->scheduled = 0;
+    }
+    pthread_mutex_unlock(&subscriber->lock);
+  }
+  pthread_mutex_unlock(&notifier->lock);
+
+  return NULL;
+}
+
+int init_notifier(Notifier_t *notifier) {
+  notifier->front = notifier->rear = notifier->stalled = NULL;
+  notifier->stopping = 0;
+  notifier->thread_count = 0;
+
+  if (pthread_mutex_init(&notifier->lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize notifier lock\n");
+    return 1;
+  }
+
+  // Stalled subscribers are retried on the monotonic clock
+  pthread_condattr_t scheduled_attr;
+  if (pthread_condattr_init(&scheduled_attr) != 0 ||
+      pthread_condattr_setclock(&scheduled_attr, CLOCK_MONOTONIC) != 0 ||
+      pthread_cond_init(&notifier->scheduled, &scheduled_attr) != 0) {
+    fprintf(stderr, "Failed to initialize condition variable\n");
+    pthread_mutex_destroy(&notifier->lock);
+    return 1;
+  }
+  pthread_condattr_destroy(&scheduled_attr);
+
+  if (pthread_cond_init(&notifier->pushed, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize condition variable\n");
+    pthread_cond_destroy(&notifier->scheduled);
+    pthread_mutex_destroy(&notifier->lock);
+    return 1;
+  }
+
+  for (; notifier->thread_count < NOTIFIER_THREAD_COUNT; notifier->thread_count++) {
+    if (pthread_create(&notifier->threads[notifier->thread_count], NULL, push_changes, (void *)notifier) != 0) {
+      fprintf(stderr, "Failed to dispatch notifier thread\n");
+      free_notifier(notifier);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int init_subscriber(Subscriber_t *subscriber, Notifier_t *notifier, PushSender_t send, void *ctx) {
+  subscriber->notifier = notifier;
+  subscriber->send = send;
+  subscriber->ctx = ctx;
+  subscriber->watch_count = 0;
+  memset(subscriber->first_lost, 0, sizeof(subscriber->first_lost));
+  subscriber->scheduled = 0;
+  subscriber->gone = 0;
+  subscriber->buffered = 0;
+  subscriber->buffer = NULL;
+  subscriber->unsent = 0;
+  subscriber->frames = NULL;
+  subscriber->pushing = 0;
+  subscriber->next = NULL;
+
+  if (pthread_mutex_init(&subscriber->lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize subscriber lock\n");
+    return 1;
+  }
+  return 0;
+}
+
+int watch_events(Subscriber_t *subscriber, size_t num_events, const unsigned int *event_ids) {
+  size_t watch_count = subscriber->watch_count;
+
+  // Nothing is queued for the subscriber before it watches an event, so the buffers are not in use yet
+  if (subscriber->buffer == NULL) {
+    subscriber->buffer = malloc(SUBSCRIBER_BUFFER_SIZE);
+    subscriber->frames = malloc(SUBSCRIBER_FRAMES_SIZE);
+    if (subscriber->buffer == NULL || subscriber->frames == NULL) {
+      fprintf(stderr, "Failed to allocate push buffers\n");
+      free(subscriber->buffer);
+      free(subscriber->frames);
+      subscriber->buffer = subscriber->frames = NULL;
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < num_events; i++) {
+    size_t slot = 0;
+    while (slot < watch_count && subscriber->watchers[slot].event_id != event_ids[i]) slot++;
+    if (slot < watch_count) continue;
+
+    Watcher_t *watcher = &subscriber->watchers[watch_count];
+    if (watch_count == WATCH_MAX_EVENTS) {
+      fprintf(stderr, "Too many events watched\n");
+    } else {
+      watcher->notify = queue_push;
+      watcher->ctx = subscriber;
+      if (ems_watch(event_ids[i], watcher) == 0) {
+        watch_count++;
+        continue;
+      }
+    }
+
+    // Events added by this call stop being watched, pushes already queued for them are still sent
+    for (size_t added = subscriber->watch_count; added < watch_count; added++)
+      ems_unwatch(&subscriber->watchers[added]);
+    pthread_mutex_lock(&subscriber->lock);
+    for (size_t added = subscriber->watch_count; added < watch_count; added++) subscriber->first_lost[added] = 0;
+    pthread_mutex_unlock(&subscriber->lock);
+    return 1;
+  }
+
+  subscriber->watch_count = watch_count;
+  return 0;
+}
+
+/// Removes a subscriber from a list of subscribers, if it is in it.
+/// @param front Pointer to the first subscriber of the list.
+/// @param rear Pointer to the last subscriber of the list, `NULL` if the list does not keep it.
+/// @param subscriber Subscriber to remove.
+static void unlink_subscriber(Subscriber_t **front, Subscriber_t **rear, Subscriber_t *subscriber) {
+  Subscriber_t *previous = NULL;
+  Subscriber_t *current = *front;
+  while (current != NULL && current != subscriber) {
+    previous = current;
+    current = current->next;
+  }
+  if (current == NULL) return;
+
+  if (previous != NULL)
+    previous->next = current->next;
+  else
+    *front = current->next;
+  if (rear != NULL && *rear == current) *rear = previous;
+}
+
+void free_subscriber(Subscriber_t *subscriber) {
+  Notifier_t *notifier = subscriber->notifier;
+
+  for (size_t slot = 0; slot < subscriber->watch_count; slot++) ems_unwatch(&subscriber->watchers[slot]);
+  subscriber->watch_count = 0;
+
+  pthread_mutex_lock(&subscriber->lock);
+  subscriber->gone = 1;
+  pthread_mutex_unlock(&subscriber->lock);
+
+  // Nothing can queue it anymore, but it may still be queued, stalled or being pushed to
+  pthread_mutex_lock(&notifier->lock);
+  while (subscriber->pushing) pthread_cond_wait(&notifier->pushed, &notifier->lock);
+
+  unlink_subscriber(&notifier->front, &notifier->rear, subscriber);
+  unlink_subscriber(&notifier->stalled, NULL, subscriber);
+  pthread_mutex_unlock(&notifier->lock);
+
+  pthread_mutex_destroy(&subscriber->lock);
+  free(subscriber->buffer);
+  free(subscriber->frames);
+  subscriber->buffer = subscriber->frames = NULL;
+}
+
+void free_notifier(Notifier_t *notifier) {
+  pthread_mutex_lock(&notifier->lock);
+  notifier->stopping = 1;
+  pthread_mutex_unlock(&notifier->lock);
+  pthread_cond_broadcast(&notifier->scheduled);
+
+  for (unsigned int i = 0; i < notifier->thread_count; i++) pthread_join(notifier->threads[i], NULL);
+
+  pthread_cond_destroy(&notifier->pushed);
+  pthread_cond_destroy(&notifier->scheduled);
+  pthread_mutex_destroy(&notifier->lock);
+}
@@ -0,0 +1,104 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common/constants.h"
+#include "operations.h"
+
+#define NOTIFIER_THREAD_COUNT 4                  // Subscribers pushed to at once
+#define SUBSCRIBER_BUFFER_SIZE 16384             // Bytes of pushes a subscriber may have waiting before dropping some
+#define PUSH_HEADER_SIZE (6 * sizeof(uint32_t))  // Size of a push frame without its seats
+#define PUSH_RETRY_MS 10                         // Delay before pushing again to a client that did not take them all
+
+// Size of the largest push frame
+#define PUSH_MAX_SIZE (PUSH_HEADER_SIZE + MAX_RESERVATION_SIZE * sizeof(uint32_t))
+
+// Size of the pushes taken from a subscriber at once: its buffer and a catch-up push per watchable event
+#define SUBSCRIBER_FRAMES_SIZE (SUBSCRIBER_BUFFER_SIZE + WATCH_MAX_EVENTS * PUSH_HEADER_SIZE)
+
+struct Notifier;
+
+/// Sends the pushes the client of a subscriber can take right away, without waiting for it.
+/// @param ctx Context given to `init_subscriber`.
+/// @param frames Whole push frames, back to back.
+/// @param size Size of `frames`.
+/// @return Number of bytes taken from `frames`, a whole number of frames, -1 if the client is gone.
+typedef ssize_t (*PushSender_t)(void *ctx, const char *frames, size_t size);
+
+/// Events watched by a client and the reservations of those events waiting to be pushed to it. Reservations are
+/// queued by the threads that make them and pushed by the notifier, so a slow client never holds them up.
+/// When the buffer is full, the pushes of an event are dropped and replaced with a single push telling the client
+/// to catch up from the first one dropped. Pushes the client does not take are kept and tried again later, so a
+/// client that stops reading never holds up a notifier thread. The buffers are only allocated once the first event
+/// is watched, so sessions that never watch one do not carry them.
+typedef struct Subscriber {
+  struct Notifier *notifier;
+  PushSender_t send;
+  void *ctx;                                  // Passed to `send`
+  size_t watch_count;                         // Number of events in `watchers`. Only used by the subscriber's owner
+  Watcher_t watchers[WATCH_MAX_EVENTS];       // One per watched event
+  pthread_mutex_t lock;                       // Protects the fields below, up to `buffer`
+  unsigned int first_lost[WATCH_MAX_EVENTS];  // Per watched event, lowest id of the pushes dropped, 0 if none
+  int scheduled;                              // Whether it is queued on the notifier or being pushed to
+  int gone;                                   // Whether the client is gone, after which nothing is queued anymore
+  size_t buffered;                            // Number of bytes in `buffer`
+  char *buffer;                               // `SUBSCRIBER_BUFFER_SIZE` bytes of pushes to send, oldest first
+
+  // Only used by the notifier thread pushing to it
+  size_t unsent;  // Number of bytes in `frames`
+  char *frames;   // `SUBSCRIBER_FRAMES_SIZE` bytes of pushes taken but not sent yet
+
+  // Protected by the notifier's lock
+  int pushing;              // Whether a notifier thread is sending its pushes
+  struct Subscriber *next;  // Next subscriber queued on the notifier
+} Subscriber_t;
+
+/// Threads pushing the reservations of watched events to their subscribers.
+typedef struct Notifier {
+  pthread_t threads[NOTIFIER_THREAD_COUNT];
+  unsigned int thread_count;
+  Subscriber_t *front, *rear;  // Subscribers with pushes waiting, oldest first
+  Subscriber_t *stalled;       // Subscribers whose client did not take all of their pushes, queued again at `retry_at`
+  struct timespec retry_at;    // On the monotonic clock
+  int stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t scheduled;  // Signaled when a subscriber is queued or the notifier stops
+  pthread_cond_t pushed;     // Signaled when a notifier thread is done pushing to a subscriber
+} Notifier_t;
+
+/// Initializes the notifier and starts its threads.
+/// @param notifier Pointer to the notifier.
+/// @return 0 if successful, 1 otherwise.
+int init_notifier(Notifier_t *notifier);
+
+/// Initializes a subscriber that watches no event yet.
+/// @param subscriber Pointer to the subscriber.
+/// @param notifier Notifier that pushes to it.
+/// @param send Function that sends pushes to the client.
+/// @param ctx Argument passed to `send`.
+/// @return 0 if successful, 1 otherwise.
+int init_subscriber(Subscriber_t *subscriber, Notifier_t *notifier, PushSender_t send, void *ctx);
+
+/// Starts pushing the reservations of the given events to a subscriber. Events it already watches are skipped.
+/// The subscriber's buffers are allocated by the first call.
+/// @param subscriber Pointer to the subscriber.
+/// @param num_events Number of events.
+/// @param event_ids Ids of the events.
+/// @return 0 if every event is watched, 1 otherwise, in which case none of them was added.
+int watch_events(Subscriber_t *subscriber, size_t num_events, const unsigned int *event_ids);
+
+/// Stops watching every event of a subscriber and waits until nothing is being pushed to it, then frees its resources.
+/// @param subscriber Pointer to the subscriber.
+void free_subscriber(Subscriber_t *subscriber);
+
+/// Stops the threads and frees all resources of the notifier.
+/// @note Must only be called once every subscriber was freed.
+/// @param notifier Pointer to the notifier.
+void free_notifier(Notifier_t *notifier);
+
+#endif
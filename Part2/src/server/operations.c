@@ -1,26 +1,172 @@
+#include "operations.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
-#include "common/io.h"
+#include "common/constants.h"
 #include "eventlist.h"
 
+#define SEAT_CLAIMED UINT_MAX      // Placeholder for a seat claimed by an unfinished lock-free reservation
+#define SNAPSHOT_MAX_RETRIES 8     // Optimistic snapshot attempts before holding back the writes
+#define FLIGHT_BUCKETS 64          // Buckets of the table of open flights
+#define COMBINE_MAX_PASSES 4       // Batches a combiner applies before leaving the rest to another thread
+#define RESERVATION_PENDING -1     // Status of a published reservation that was not applied yet
+#define DELTA_INITIAL_CAPACITY 64  // Changed seats a delta SHOW has room for before growing
+
+// Each node of a free-run tree packs three run lengths of FREE_RUN_BITS bits. Longer runs are stored as FREE_RUN_CAP
+#define FREE_RUN_BITS 21
+#define FREE_RUN_CAP ((1u << FREE_RUN_BITS) - 1)
+
+/// Work that concurrent requests on the same event share.
+enum FlightKind {
+  FLIGHT_LOOKUP,  // Finding the event
+  FLIGHT_SHOW     // Copying the event's seats
+};
+
+/// Lookup or copy of an event done once on behalf of every thread that asked for it before it started.
+/// The thread that opened the flight does the work, the others wait for it to land with the result.
+/// Flights live on their leader's stack, so the leader waits for every holder to leave before returning.
+typedef struct Flight {
+  enum FlightKind kind;
+  unsigned int event_id;
+  struct FlightBucket* bucket;  // Bucket the flight was opened in
+  size_t holders;               // Threads that have not read the result yet, including the leader
+  int landed;                   // Whether the result is ready
+  struct Event* event;          // Result of a lookup, NULL if the event does not exist
+  SeatSnapshot_t* snapshot;     // Result of a copy, NULL if it failed
+  pthread_cond_t landed_cond;   // Signaled when the flight lands and when the last holder other than the leader leaves
+  struct Flight* next;          // Next open flight in the same bucket
+} Flight_t;
+
+/// Flights of the events whose id falls in the bucket. Each bucket has its own lock, so lookups of different
+/// events rarely contend.
+typedef struct FlightBucket {
+  pthread_mutex_t lock;  // Protects the bucket and every flight opened in it
+  Flight_t* open;        // Flights that still accept holders
+} FlightBucket_t;
+
+/// Reservation published to an event by a thread waiting for a combiner to apply it.
+struct PendingReservation {
+  size_t num_seats;
+  size_t* seats;                    // Sorted indexes of the seats to reserve
+  int result;                       // 0 if the seats were reserved, 1 otherwise. Only used by the combiner
+  unsigned int reservation_id;      // Id given to the reservation, set before `status` is published
+  atomic_int status;                // `RESERVATION_PENDING` until `result` is published
+  struct PendingReservation* next;  // Reservation published before this one
+};
+
+static SeatRuns_t incompressible_runs;  // Stands for the runs of copies that are not worth encoding
+
 static struct EventList* event_list = NULL;
 static unsigned int state_access_delay_us = 0;
+static atomic_uint list_version = 1;  // Bumped after every event creation
+static enum ReserveMode reserve_mode = RESERVE_MUTEX;
+
+static FlightBucket_t flight_buckets[FLIGHT_BUCKETS];  // Open flights, by event id
+
+/// Waits to simulate a real system accessing a costly memory resource.
+static void state_access_delay() {
+  struct timespec delay = {0, state_access_delay_us * 1000};
+  nanosleep(&delay, NULL);  // Should not be removed
+}
+
+/// Joins the open flight of the given kind for an event, or opens one if there is none.
+/// @param kind Work to be shared.
+/// @param event_id Id of the event.
+/// @param own Flight on the caller's stack, opened if there is none to join.
+/// @param leader Pointer to store 1 in if the flight was opened, so the caller must do the work, 0 otherwise.
+/// @return Joined flight, `own` if it was opened.
+static Flight_t* join_flight(enum FlightKind kind, unsigned int event_id, Flight_t* own, int* leader) {
+  FlightBucket_t* bucket = &flight_buckets[event_id % FLIGHT_BUCKETS];
+
+  pthread_mutex_lock(&bucket->lock);
+  for (Flight_t* flight = bucket->open; flight != NULL; flight = flight->next) {
+    if (flight->kind == kind && flight->event_id == event_id) {
+      flight->holders++;
+      pthread_mutex_unlock(&bucket->lock);
+      *leader = 0;
+      return flight;
+    }
+  }
+
+  *own = (Flight_t){.kind = kind, .event_id = event_id, .bucket = bucket, .holders = 1, .next = bucket->open};
+  pthread_cond_init(&own->landed_cond, NULL);
+  bucket->open = own;
+  pthread_mutex_unlock(&bucket->lock);
+
+  *leader = 1;
+  return own;
+}
+
+/// Stops a flight from accepting holders. Called by its leader right before the work that observes the state,
+/// so that no holder gets a result older than its own request.
+/// @param flight Flight opened by the caller.
+static void close_flight(Flight_t* flight) {
+  pthread_mutex_lock(&flight->bucket->lock);
+  Flight_t** link = &flight->bucket->open;
+  while (*link != flight) link = &(*link)->next;
+  *link = flight->next;
+  pthread_mutex_unlock(&flight->bucket->lock);
+}
+
+/// Hands the result stored in a closed flight to its holders and waits for them to read it.
+/// @param flight Flight opened by the caller, with its result set.
+static void land_flight(Flight_t* flight) {
+  pthread_mutex_lock(&flight->bucket->lock);
+  if (flight->snapshot != NULL) atomic_init(&flight->snapshot->refs, flight->holders);
+  flight->landed = 1;
+  pthread_cond_broadcast(&flight->landed_cond);
+  while (flight->holders > 1) pthread_cond_wait(&flight->landed_cond, &flight->bucket->lock);
+  pthread_mutex_unlock(&flight->bucket->lock);
+
+  pthread_cond_destroy(&flight->landed_cond);
+}
+
+/// Waits for a joined flight to land and leaves it.
+/// @param flight Flight joined by the caller.
+/// @param event Pointer to store the result of a lookup in.
+/// @param snapshot Pointer to store the result of a copy in, holding a reference to it.
+static void await_flight(Flight_t* flight, struct Event** event, SeatSnapshot_t** snapshot) {
+  pthread_mutex_lock(&flight->bucket->lock);
+  while (!flight->landed) pthread_cond_wait(&flight->landed_cond, &flight->bucket->lock);
+  *event = flight->event;
+  *snapshot = flight->snapshot;
+  if (--flight->holders == 1) pthread_cond_broadcast(&flight->landed_cond);  // Only the leader is left
+  pthread_mutex_unlock(&flight->bucket->lock);
+}
 
 /// Gets the event with the given ID from the state.
-/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @note Will wait to simulate a real system accessing a costly memory resource. Concurrent lookups
+/// of the same event share that wait, through a flight guarded by the lock of the event's flight bucket.
+/// The lookup itself takes no locks.
 /// @param event_id The ID of the event to get.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  struct timespec delay = {0, state_access_delay_us * 1000};
-  nanosleep(&delay, NULL);  // Should not be removed
+static struct Event* get_event_with_delay(unsigned int event_id) {
+  struct Event* event;
+  SeatSnapshot_t* snapshot;
+  Flight_t own;
+  int leader;
 
-  return get_event(event_list, event_id, from, to);
+  Flight_t* flight = join_flight(FLIGHT_LOOKUP, event_id, &own, &leader);
+  if (!leader) {
+    await_flight(flight, &event, &snapshot);
+    return event;
+  }
+
+  state_access_delay();
+
+  close_flight(flight);
+  event = get_event(get_shard(event_list, event_id), event_id);
+  flight->event = event;
+  land_flight(flight);
+
+  return event;
 }
 
 /// Gets the index of a seat.
@@ -31,16 +177,661 @@ static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
-int ems_init(unsigned int delay_us) {
+/// Comparison function to sort seat indexes with `qsort`.
+static int compare_seats(const void* a, const void* b) {
+  size_t lhs = *(const size_t*)a, rhs = *(const size_t*)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+/// Validates the coordinates of a reservation and converts them into sorted seat indexes.
+/// @param event Event the reservation is for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param seats Array of size `num_seats` to store the seat indexes in.
+/// @return 0 if every seat is in bounds and appears only once, 1 otherwise.
+static int get_seat_indexes(struct Event* event, size_t num_seats, size_t* xs, size_t* ys, size_t* seats) {
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Invalid number of seats\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
+      fprintf(stderr, "Seat out of bounds\n");
+      return 1;
+    }
+    seats[i] = seat_index(event, xs[i], ys[i]);
+  }
+
+  qsort(seats, num_seats, sizeof(size_t), compare_seats);
+  for (size_t i = 1; i < num_seats; i++) {
+    if (seats[i] == seats[i - 1]) {
+      fprintf(stderr, "Seat requested more than once\n");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/// Gets the stripe that protects a seat.
+/// @param event Event the seat belongs to.
+/// @param seat Index of the seat.
+/// @return Index of the stripe.
+static size_t stripe_index(struct Event* event, size_t seat) { return seat / event->cols / event->rows_per_stripe; }
+
+/// Locks the stripes covering the given seats, in ascending order.
+/// @param event Event to lock the stripes of.
+/// @param num_seats Number of seats.
+/// @param seats Sorted indexes of the seats.
+/// @param locked Array of size `num_seats` to store the indexes of the locked stripes in.
+/// @return Number of stripes locked.
+static size_t lock_stripes(struct Event* event, size_t num_seats, size_t* seats, size_t* locked) {
+  size_t num_locked = 0;
+
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t stripe = stripe_index(event, seats[i]);
+    if (num_locked > 0 && locked[num_locked - 1] == stripe) continue;
+
+    pthread_mutex_lock(&event->stripes[stripe]);
+    locked[num_locked++] = stripe;
+  }
+
+  return num_locked;
+}
+
+/// Unlocks the stripes locked by `lock_stripes`.
+/// @param event Event to unlock the stripes of.
+/// @param num_locked Number of stripes locked.
+/// @param locked Indexes of the locked stripes.
+static void unlock_stripes(struct Event* event, size_t num_locked, size_t* locked) {
+  for (size_t i = 0; i < num_locked; i++) pthread_mutex_unlock(&event->stripes[locked[i]]);
+}
+
+/// Marks the beginning of a write to an event's seats, so snapshots taken meanwhile are retried.
+/// Waits first while a reader holds back new writes, see `read_seats`.
+/// @param event Event about to be written to.
+static void begin_seat_writes(struct Event* event) {
+  while (1) {
+    atomic_fetch_add_explicit(&event->writes_started, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&event->readers_waiting, memory_order_seq_cst) == 0) break;
+
+    // Nothing was written, so the write is ended right away and the reader can go on
+    atomic_fetch_add_explicit(&event->writes_finished, 1, memory_order_release);
+    while (atomic_load_explicit(&event->readers_waiting, memory_order_relaxed) != 0) sched_yield();
+  }
+  atomic_thread_fence(memory_order_release);
+}
+
+/// Marks the end of a write to an event's seats.
+/// @param event Event that was written to.
+static void end_seat_writes(struct Event* event) {
+  atomic_fetch_add_explicit(&event->writes_finished, 1, memory_order_release);
+}
+
+/// Reads the seats of an event as of a single point in time.
+/// @note Never blocks reservations in the common case. The read is retried while writes overlap it,
+/// and after `SNAPSHOT_MAX_RETRIES` failed attempts the writes are held back: in mutex mode by taking
+/// the stripes, in the other modes, which do not lock, by having new writes wait in `begin_seat_writes`
+/// until the writes already started are finished and the seats were read.
+/// Reservation ids are drawn while writing, so every reservation with an id up to the value of
+/// `event->reservations` seen by the reader is in the seats it read.
+/// @param event Event to be read.
+/// @param reader Function reading the seats. Each attempt runs it again, so it must start over every time.
+/// @param ctx Argument passed to `reader`.
+static void read_seats(struct Event* event, void (*reader)(struct Event* event, void* ctx), void* ctx) {
+  for (unsigned int attempt = 0;; attempt++) {
+    // The read is consistent if no write started that had not finished before the read began
+    unsigned int finished = atomic_load_explicit(&event->writes_finished, memory_order_acquire);
+    reader(event, ctx);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&event->writes_started, memory_order_relaxed) == finished) return;
+
+    if (attempt + 1 < SNAPSHOT_MAX_RETRIES) continue;
+    if (reserve_mode != RESERVE_MUTEX) {
+      // Writes started after this see the flag and wait, so the started ones are the only ones left
+      atomic_fetch_add_explicit(&event->readers_waiting, 1, memory_order_seq_cst);
+      while (atomic_load_explicit(&event->writes_finished, memory_order_seq_cst) !=
+             atomic_load_explicit(&event->writes_started, memory_order_seq_cst))
+        sched_yield();
+      reader(event, ctx);
+      atomic_fetch_sub_explicit(&event->readers_waiting, 1, memory_order_release);
+      return;
+    }
+
+    for (size_t stripe = 0; stripe < event->stripe_count; stripe++) pthread_mutex_lock(&event->stripes[stripe]);
+    reader(event, ctx);
+    for (size_t stripe = 0; stripe < event->stripe_count; stripe++) pthread_mutex_unlock(&event->stripes[stripe]);
+    return;
+  }
+}
+
+/// Copies the reservation of every seat of an event. Reader for `read_seats`.
+/// @param event Event to be copied.
+/// @param ctx Array of size rows * cols to store the copy in.
+static void copy_seats(struct Event* event, void* ctx) {
+  unsigned int* seats = ctx;
+  size_t num_seats = event->rows * event->cols;
+
+  for (size_t i = 0; i < num_seats; i++) seats[i] = atomic_load_explicit(&event->data[i], memory_order_relaxed);
+}
+
+/// Copies the reservation of every seat of an event as of a single point in time.
+/// @param event Event to be copied.
+/// @param seats Array of size rows * cols to store the copy in.
+static void snapshot_seats(struct Event* event, unsigned int* seats) { read_seats(event, copy_seats, seats); }
+
+/// Section of an event being copied by `copy_range`.
+typedef struct RangeCopy {
+  const size_t* rows;   // First and last row of the section
+  const size_t* cols;   // First and last column of the section
+  unsigned int* seats;  // Array of the size of the section to store the copy in
+} RangeCopy_t;
+
+/// Copies the reservation of every seat in a section of an event. Reader for `read_seats`.
+/// @param event Event to be copied.
+/// @param ctx Section to copy.
+static void copy_range(struct Event* event, void* ctx) {
+  RangeCopy_t* copy = ctx;
+  unsigned int* seats = copy->seats;
+
+  for (size_t row = copy->rows[0]; row <= copy->rows[1]; row++) {
+    // Each row of the section is contiguous in the event
+    _Atomic(unsigned int)* data = &event->data[seat_index(event, row, copy->cols[0])];
+    for (size_t col = copy->cols[0]; col <= copy->cols[1]; col++)
+      *seats++ = atomic_load_explicit(data++, memory_order_relaxed);
+  }
+}
+
+/// Seats reserved after a given reservation, being collected by `collect_changes`.
+typedef struct ChangeCollector {
+  unsigned int since;      // Id of the last reservation the caller knows of
+  SeatChanges_t* changes;  // Where the seats are collected
+  size_t capacity;         // Number of pairs `changes->pairs` has room for
+  int failed;              // Whether memory ran out
+} ChangeCollector_t;
+
+/// Collects the seats of an event holding a reservation newer than the given one. Reader for `read_seats`.
+/// @note Seats only ever go from free to a reservation id, and ids only grow, so they are the seats
+/// that changed since that reservation.
+/// @param event Event to be read.
+/// @param ctx Collector of the seats.
+static void collect_changes(struct Event* event, void* ctx) {
+  ChangeCollector_t* collector = ctx;
+  SeatChanges_t* changes = collector->changes;
+  size_t num_seats = event->rows * event->cols;
+
+  changes->reservations = atomic_load_explicit(&event->reservations, memory_order_acquire);
+  changes->count = 0;
+  collector->failed = 0;
+
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int reservation_id = atomic_load_explicit(&event->data[i], memory_order_relaxed);
+    if (reservation_id <= collector->since || reservation_id == SEAT_CLAIMED) continue;
+
+    if (changes->count == collector->capacity) {
+      size_t capacity = collector->capacity ? 2 * collector->capacity : DELTA_INITIAL_CAPACITY;
+      uint32_t* pairs = realloc(changes->pairs, 2 * capacity * sizeof(uint32_t));
+      if (pairs == NULL) {
+        collector->failed = 1;
+        return;
+      }
+      changes->pairs = pairs;
+      collector->capacity = capacity;
+    }
+
+    changes->pairs[2 * changes->count] = (uint32_t)i;
+    changes->pairs[2 * changes->count + 1] = reservation_id;
+    changes->count++;
+  }
+}
+
+/// Applies a reservation while holding the stripes its seats belong to.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param seats Sorted indexes of the seats to reserve.
+/// @param reservation_id Pointer to store the id of the reservation in.
+/// @return 0 if the seats were reserved, 1 otherwise.
+static int reserve_seats_locked(struct Event* event, size_t num_seats, size_t* seats, unsigned int* reservation_id) {
+  size_t locked[MAX_RESERVATION_SIZE];
+  size_t num_locked = lock_stripes(event, num_seats, seats, locked);
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (atomic_load_explicit(&event->data[seats[i]], memory_order_relaxed) != 0) {
+      unlock_stripes(event, num_locked, locked);
+      return 1;
+    }
+  }
+
+  begin_seat_writes(event);
+  *reservation_id = atomic_fetch_add_explicit(&event->reservations, 1, memory_order_relaxed) + 1;
+  for (size_t i = 0; i < num_seats; i++) {
+    atomic_store_explicit(&event->data[seats[i]], *reservation_id, memory_order_relaxed);
+  }
+  end_seat_writes(event);
+
+  unlock_stripes(event, num_locked, locked);
+  return 0;
+}
+
+/// Applies a reservation without locking. Each seat is claimed with compare-and-swap and
+/// the claims are rolled back if any seat is already taken.
+/// @note Seats are claimed in ascending order, so waiting for another reservation's claim
+/// to be resolved cannot form a cycle.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param seats Sorted indexes of the seats to reserve.
+/// @param reservation_id Pointer to store the id of the reservation in.
+/// @return 0 if the seats were reserved, 1 otherwise.
+static int reserve_seats_cas(struct Event* event, size_t num_seats, size_t* seats, unsigned int* reservation_id) {
+  begin_seat_writes(event);
+
+  for (size_t i = 0; i < num_seats; i++) {
+    unsigned int expected = 0;
+    while (!atomic_compare_exchange_weak_explicit(&event->data[seats[i]], &expected, SEAT_CLAIMED,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+      if (expected == SEAT_CLAIMED) {
+        sched_yield();  // The claimer may still roll back, so wait for the outcome
+      } else if (expected != 0) {
+        for (size_t j = 0; j < i; j++) atomic_store_explicit(&event->data[seats[j]], 0, memory_order_relaxed);
+        end_seat_writes(event);
+        return 1;
+      }
+      expected = 0;
+    }
+  }
+
+  // Ids are only drawn once every seat is claimed, so failed reservations do not consume one
+  *reservation_id = atomic_fetch_add_explicit(&event->reservations, 1, memory_order_relaxed) + 1;
+
+  for (size_t i = 0; i < num_seats; i++) {
+    atomic_store_explicit(&event->data[seats[i]], *reservation_id, memory_order_relaxed);
+  }
+  end_seat_writes(event);
+
+  return 0;
+}
+
+/// Applies a batch of published reservations in a single pass over the event's seats.
+/// @note Only called by the thread combining, so the seats have no other writer.
+/// @param event Event the reservations were published to.
+/// @param batch Published reservations, newest first.
+static void apply_published(struct Event* event, struct PendingReservation* batch) {
+  // Reverse the batch, so reservations are applied in the order they were published
+  struct PendingReservation* ordered = NULL;
+  while (batch != NULL) {
+    struct PendingReservation* next = batch->next;
+    batch->next = ordered;
+    ordered = batch;
+    batch = next;
+  }
+
+  begin_seat_writes(event);
+  for (struct PendingReservation* pending = ordered; pending != NULL; pending = pending->next) {
+    pending->result = 0;
+    for (size_t i = 0; i < pending->num_seats && !pending->result; i++) {
+      pending->result = atomic_load_explicit(&event->data[pending->seats[i]], memory_order_relaxed) != 0;
+    }
+    if (pending->result) continue;
+
+    pending->reservation_id = atomic_fetch_add_explicit(&event->reservations, 1, memory_order_relaxed) + 1;
+    for (size_t i = 0; i < pending->num_seats; i++) {
+      atomic_store_explicit(&event->data[pending->seats[i]], pending->reservation_id, memory_order_relaxed);
+    }
+  }
+  end_seat_writes(event);
+
+  // Results are only published once every write is done, since publishing one lets its owner return
+  while (ordered != NULL) {
+    struct PendingReservation* next = ordered->next;
+    atomic_store_explicit(&ordered->status, ordered->result, memory_order_release);
+    ordered = next;
+  }
+}
+
+/// Publishes a reservation to the event and waits until it is applied, applying the published
+/// reservations of other threads too if no thread is doing so already.
+/// @note Contended events are written by one thread at a time in batches, instead of every reservation
+/// taking its turn on the locks.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param seats Sorted indexes of the seats to reserve.
+/// @param reservation_id Pointer to store the id of the reservation in.
+/// @return 0 if the seats were reserved, 1 otherwise.
+static int reserve_seats_combined(struct Event* event, size_t num_seats, size_t* seats,
+                                  unsigned int* reservation_id) {
+  struct PendingReservation reservation = {.num_seats = num_seats, .seats = seats};
+  atomic_init(&reservation.status, RESERVATION_PENDING);
+
+  reservation.next = atomic_load_explicit(&event->published, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&event->published, &reservation.next, &reservation,
+                                                memory_order_release, memory_order_relaxed)) {
+  }
+
+  int status;
+  while ((status = atomic_load_explicit(&reservation.status, memory_order_acquire)) == RESERVATION_PENDING) {
+    if (atomic_exchange_explicit(&event->combining, 1, memory_order_acquire)) {
+      sched_yield();  // Another thread is combining and will most likely apply this reservation too
+      continue;
+    }
+
+    for (unsigned int pass = 0; pass < COMBINE_MAX_PASSES; pass++) {
+      struct PendingReservation* batch = atomic_exchange_explicit(&event->published, NULL, memory_order_acquire);
+      if (batch == NULL) break;
+      apply_published(event, batch);
+    }
+    atomic_store_explicit(&event->combining, 0, memory_order_release);
+  }
+
+  *reservation_id = reservation.reservation_id;
+  return status;
+}
+
+/// Tells every watcher of an event about a reservation.
+/// @param event Event the seats were reserved in.
+/// @param reservation_id Id of the reservation.
+/// @param num_seats Number of seats reserved.
+/// @param seats Sorted indexes of the seats reserved.
+static void notify_watchers(struct Event* event, unsigned int reservation_id, size_t num_seats, size_t* seats) {
+  // Events nobody watches are not locked
+  if (atomic_load_explicit(&event->watchers, memory_order_acquire) == NULL) return;
+
+  pthread_mutex_lock(&event->watchers_lock);
+  for (Watcher_t* watcher = atomic_load_explicit(&event->watchers, memory_order_relaxed); watcher != NULL;
+       watcher = watcher->next) {
+    watcher->notify(watcher, reservation_id, num_seats, seats);
+  }
+  pthread_mutex_unlock(&event->watchers_lock);
+}
+
+/// Applies a reservation the way the server was configured to.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param seats Sorted indexes of the seats to reserve.
+/// @param reservation_id Pointer to store the id of the reservation in.
+/// @return 0 if the seats were reserved, 1 if any of them already was.
+static int reserve_seats(struct Event* event, size_t num_seats, size_t* seats, unsigned int* reservation_id) {
+  if (reserve_mode == RESERVE_CAS) return reserve_seats_cas(event, num_seats, seats, reservation_id);
+  if (reserve_mode == RESERVE_COMBINE) return reserve_seats_combined(event, num_seats, seats, reservation_id);
+  return reserve_seats_locked(event, num_seats, seats, reservation_id);
+}
+
+/// Runs of free seats of a section of a row. Lengths are capped at `FREE_RUN_CAP`, which is more than any
+/// reservation asks for, so capped lengths still compare the same against what is asked for.
+typedef struct FreeRuns {
+  size_t prefix;   // Free seats at the start of the section
+  size_t suffix;   // Free seats at the end of the section
+  size_t longest;  // Longest run of free seats in the section
+} FreeRuns_t;
+
+/// Packs the runs of a section into a node of a free-run tree.
+/// @param runs Runs of the section, capped at `FREE_RUN_CAP`.
+/// @return Value of the node.
+static uint64_t pack_free_runs(FreeRuns_t runs) {
+  return (uint64_t)runs.prefix | (uint64_t)runs.suffix << FREE_RUN_BITS | (uint64_t)runs.longest << 2 * FREE_RUN_BITS;
+}
+
+/// Unpacks a node of a free-run tree.
+/// @param node Value of the node.
+/// @return Runs of the section the node covers.
+static FreeRuns_t unpack_free_runs(uint64_t node) {
+  return (FreeRuns_t){.prefix = (size_t)(node & FREE_RUN_CAP),
+                      .suffix = (size_t)(node >> FREE_RUN_BITS & FREE_RUN_CAP),
+                      .longest = (size_t)(node >> 2 * FREE_RUN_BITS & FREE_RUN_CAP)};
+}
+
+/// Caps the length of a run at `FREE_RUN_CAP`.
+static size_t cap_free_run(size_t length) { return length < FREE_RUN_CAP ? length : FREE_RUN_CAP; }
+
+/// Computes the runs of a section of a row from the runs of its two halves.
+/// @param left Runs of the first half.
+/// @param right Runs of the second half.
+/// @param left_seats Number of seats of the first half.
+/// @param right_seats Number of seats of the second half.
+/// @return Runs of the whole section.
+static FreeRuns_t merge_free_runs(FreeRuns_t left, FreeRuns_t right, size_t left_seats, size_t right_seats) {
+  FreeRuns_t runs = {.prefix = left.prefix, .suffix = right.suffix, .longest = left.longest};
+
+  // A half whose seats are all free extends the run of the other half
+  if (left.prefix == cap_free_run(left_seats)) runs.prefix = cap_free_run(left_seats + right.prefix);
+  if (right.suffix == cap_free_run(right_seats)) runs.suffix = cap_free_run(right_seats + left.suffix);
+  if (right.longest > runs.longest) runs.longest = right.longest;
+  if (cap_free_run(left.suffix + right.prefix) > runs.longest) runs.longest = cap_free_run(left.suffix + right.prefix);
+  return runs;
+}
+
+/// Gets the free-run tree of a row.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @return Nodes of the tree, indexed from 1.
+static _Atomic(uint64_t)* free_run_tree(struct Event* event, size_t row) {
+  return &event->free_runs[row * 2 * event->free_run_leaves];
+}
+
+/// Counts the seats of a row covered by a node of its free-run tree.
+/// @param event Event the row belongs to.
+/// @param first_leaf Index of the first leaf under the node, starting at 0.
+/// @param leaves Number of leaves under the node.
+/// @return Number of seats, 0 for the leaves past the end of the row.
+static size_t free_run_seats(struct Event* event, size_t first_leaf, size_t leaves) {
+  size_t first = first_leaf * FREE_RUN_BLOCK, end = (first_leaf + leaves) * FREE_RUN_BLOCK;
+  if (first >= event->cols) return 0;
+  return (end < event->cols ? end : event->cols) - first;
+}
+
+/// Fills in the free-run trees of an event whose seats are all free.
+/// @param event Event that was just created.
+static void init_free_runs(struct Event* event) {
+  size_t leaves = event->free_run_leaves;
+
+  for (size_t row = 0; row < event->rows; row++) {
+    _Atomic(uint64_t)* tree = free_run_tree(event, row);
+    for (size_t node = 1, first_leaf = 0, width = leaves; node < 2 * leaves; node++, first_leaf += width) {
+      if ((node & (node - 1)) == 0 && node > 1) {  // First node of the next level
+        width /= 2;
+        first_leaf = 0;
+      }
+      size_t seats = cap_free_run(free_run_seats(event, first_leaf, width));
+      atomic_init(&tree[node], pack_free_runs((FreeRuns_t){.prefix = seats, .suffix = seats, .longest = seats}));
+    }
+  }
+}
+
+/// Reads the runs of free seats of a block of a row. Seats being claimed count as free, since the claim may still be
+/// rolled back.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @param leaf Index of the block, starting at 0.
+/// @return Runs of the block.
+static FreeRuns_t read_free_runs(struct Event* event, size_t row, size_t leaf) {
+  size_t seats = free_run_seats(event, leaf, 1);
+  _Atomic(unsigned int)* data = &event->data[row * event->cols + leaf * FREE_RUN_BLOCK];
+  FreeRuns_t runs = {0, 0, 0};
+  size_t run = 0;
+
+  for (size_t col = 0; col < seats; col++) {
+    unsigned int reservation_id = atomic_load_explicit(&data[col], memory_order_relaxed);
+    run = reservation_id == 0 || reservation_id == SEAT_CLAIMED ? run + 1 : 0;
+    if (run > runs.longest) runs.longest = run;
+    if (run == col + 1) runs.prefix = run;
+  }
+  runs.suffix = run;
+  return runs;
+}
+
+/// Updates a leaf of a row's free-run tree from the seats of its block.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @param leaf Index of the leaf, starting at 0.
+/// @return 1 if the leaf changed, 0 if it already held the runs of its block.
+static int update_free_run_leaf(struct Event* event, size_t row, size_t leaf) {
+  _Atomic(uint64_t)* node = &free_run_tree(event, row)[event->free_run_leaves + leaf];
+  uint64_t stored = atomic_load_explicit(node, memory_order_acquire), runs;
+
+  do {
+    runs = pack_free_runs(read_free_runs(event, row, leaf));
+    if (runs == stored) return 0;
+  } while (!atomic_compare_exchange_weak_explicit(node, &stored, runs, memory_order_acq_rel, memory_order_acquire));
+  return 1;
+}
+
+/// Updates a node of a row's free-run tree from its children.
+/// @param event Event the row belongs to.
+/// @param tree Free-run tree of the row.
+/// @param node Index of the node.
+/// @param first_leaf Index of the first leaf under the node.
+/// @param leaves Number of leaves under the node, at least 2.
+/// @return 1 if the node changed, 0 if it already held the runs of its children.
+static int update_free_run_node(struct Event* event, _Atomic(uint64_t)* tree, size_t node, size_t first_leaf,
+                                size_t leaves) {
+  size_t left_seats = free_run_seats(event, first_leaf, leaves / 2);
+  size_t right_seats = free_run_seats(event, first_leaf + leaves / 2, leaves / 2);
+  uint64_t stored = atomic_load_explicit(&tree[node], memory_order_acquire), runs;
+
+  do {
+    FreeRuns_t left = unpack_free_runs(atomic_load_explicit(&tree[2 * node], memory_order_acquire));
+    FreeRuns_t right = unpack_free_runs(atomic_load_explicit(&tree[2 * node + 1], memory_order_acquire));
+    runs = pack_free_runs(merge_free_runs(left, right, left_seats, right_seats));
+    if (runs == stored) return 0;
+  } while (
+      !atomic_compare_exchange_weak_explicit(&tree[node], &stored, runs, memory_order_acq_rel, memory_order_acquire));
+  return 1;
+}
+
+/// Updates the free-run trees of the rows a reservation was made in, from the blocks it touched up to the roots.
+/// @note Nodes are updated without locking. Each writer recomputes a node after the nodes below it changed, and a
+/// node recomputed from outdated children fails its compare-and-swap against whoever wrote it meanwhile, so the last
+/// writer of a node leaves it with the runs of its children. A node that does not change stops the walk, since
+/// whoever gave it its value also walks up from it.
+/// @param event Event the seats were reserved in.
+/// @param num_seats Number of seats reserved.
+/// @param seats Sorted indexes of the seats reserved.
+static void update_free_runs(struct Event* event, size_t num_seats, size_t* seats) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = seats[i] / event->cols, leaf = seats[i] % event->cols / FREE_RUN_BLOCK;
+    if (i > 0 && seats[i - 1] / event->cols == row && seats[i - 1] % event->cols / FREE_RUN_BLOCK == leaf) continue;
+    if (!update_free_run_leaf(event, row, leaf)) continue;
+
+    _Atomic(uint64_t)* tree = free_run_tree(event, row);
+    size_t node = event->free_run_leaves + leaf, first_leaf = leaf, leaves = 1;
+    while (node > 1) {
+      node /= 2;
+      leaves *= 2;
+      first_leaf -= first_leaf % leaves;
+      if (!update_free_run_node(event, tree, node, first_leaf, leaves)) break;
+    }
+  }
+}
+
+/// Finds the first run of free seats of a block of a row long enough for a reservation.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @param leaf Index of the block, starting at 0.
+/// @param num_seats Number of adjacent seats needed.
+/// @param col Pointer to store the index of the first seat of the run in, starting at 0.
+/// @return 1 if a run was found, 0 otherwise.
+static int find_free_run_in_block(struct Event* event, size_t row, size_t leaf, size_t num_seats, size_t* col) {
+  size_t first = leaf * FREE_RUN_BLOCK, seats = free_run_seats(event, leaf, 1);
+  _Atomic(unsigned int)* data = &event->data[row * event->cols + first];
+  size_t run = 0;
+
+  for (size_t i = 0; i < seats; i++) {
+    run = atomic_load_explicit(&data[i], memory_order_relaxed) == 0 ? run + 1 : 0;
+    if (run == num_seats) {
+      *col = first + i + 1 - num_seats;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// Finds the first run of free seats of a row long enough for a reservation, by walking down its free-run tree.
+/// @note The tree may briefly show seats as free after they were reserved, until the reservation updates it, so the
+/// run found may be taken already. Runs longer than a block are only checked when reserving them.
+/// @param event Event the row belongs to.
+/// @param row Index of the row, starting at 0.
+/// @param num_seats Number of adjacent seats needed, at most `MAX_RESERVATION_SIZE`.
+/// @param col Pointer to store the index of the first seat of the run in, starting at 0.
+/// @return 1 if a run was found, 0 if the row has none.
+static int find_free_run(struct Event* event, size_t row, size_t num_seats, size_t* col) {
+  _Atomic(uint64_t)* tree = free_run_tree(event, row);
+
+  while (unpack_free_runs(atomic_load_explicit(&tree[1], memory_order_acquire)).longest >= num_seats) {
+    size_t node = 1, first_leaf = 0, leaves = event->free_run_leaves;
+    while (leaves > 1) {
+      leaves /= 2;
+      FreeRuns_t left = unpack_free_runs(atomic_load_explicit(&tree[2 * node], memory_order_acquire));
+      FreeRuns_t right = unpack_free_runs(atomic_load_explicit(&tree[2 * node + 1], memory_order_acquire));
+      if (left.longest >= num_seats) {
+        node = 2 * node;
+      } else if (left.suffix + right.prefix >= num_seats) {
+        // The suffix is shorter than the run, so it was not capped
+        *col = first_leaf * FREE_RUN_BLOCK + free_run_seats(event, first_leaf, leaves) - left.suffix;
+        return 1;
+      } else {
+        node = 2 * node + 1;
+        first_leaf += leaves;
+      }
+    }
+    if (find_free_run_in_block(event, row, first_leaf, num_seats, col)) return 1;
+
+    // The block was taken or is being claimed, and the tree is about to be updated
+    sched_yield();
+  }
+  return 0;
+}
+
+/// Counts the seats of a reservation in the seats reserved of its event and of their rows.
+/// @param event Event the seats were reserved in.
+/// @param num_seats Number of seats reserved.
+/// @param seats Sorted indexes of the seats reserved.
+static void count_reserved(struct Event* event, size_t num_seats, size_t* seats) {
+  for (size_t i = 0; i < num_seats;) {
+    size_t row = seats[i] / event->cols, in_row = 0;
+    for (; i < num_seats && seats[i] / event->cols == row; i++) in_row++;
+    atomic_fetch_add_explicit(&event->row_reserved[row], in_row, memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&event->reserved, num_seats, memory_order_relaxed);
+}
+
+/// Makes a reservation that was just applied known: updates the free runs and the counts of seats reserved, bumps
+/// the version and tells the watchers.
+/// @param event Event the seats were reserved in.
+/// @param reservation_id Id of the reservation.
+/// @param num_seats Number of seats reserved.
+/// @param seats Sorted indexes of the seats reserved.
+static void publish_reservation(struct Event* event, unsigned int reservation_id, size_t num_seats, size_t* seats) {
+  update_free_runs(event, num_seats, seats);
+  count_reserved(event, num_seats, seats);
+
+  // Bumped after the seats are written, so whoever reads the new version also sees them
+  atomic_fetch_add_explicit(&event->version, 1, memory_order_release);
+  notify_watchers(event, reservation_id, num_seats, seats);
+}
+
+int ems_init(unsigned int delay_us, enum ReserveMode mode) {
   if (event_list != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
 
   event_list = create_list();
-  state_access_delay_us = delay_us;
+  if (event_list == NULL) return 1;
+
+  for (size_t i = 0; i < FLIGHT_BUCKETS; i++) {
+    if (pthread_mutex_init(&flight_buckets[i].lock, NULL) != 0) {
+      while (i-- > 0) pthread_mutex_destroy(&flight_buckets[i].lock);
+      free_list(event_list);
+      event_list = NULL;
+      return 1;
+    }
+    flight_buckets[i].open = NULL;
+  }
 
-  return event_list == NULL;
+  state_access_delay_us = delay_us;
+  reserve_mode = mode;
+  return 0;
 }
 
 int ems_terminate() {
@@ -49,13 +840,9 @@ int ems_terminate() {
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    perror("Error locking list rwl\n");
-    return 1;
-  }
-
+  for (size_t i = 0; i < FLIGHT_BUCKETS; i++) pthread_mutex_destroy(&flight_buckets[i].lock);
   free_list(event_list);
-  pthread_rwlock_unlock(&event_list->rwl);
+  event_list = NULL;
   return 0;
 }
 
@@ -65,237 +852,464 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    perror("Error locking list rwl\n");
+  state_access_delay();
+
+  struct EventShard* shard = get_shard(event_list, event_id);
+  if (pthread_mutex_lock(&shard->mutex) != 0) {
+    perror("Error locking shard mutex\n");
     return 1;
   }
 
-  if (get_event_with_delay(event_id, event_list->head, event_list->tail) != NULL) {
+  if (get_event(shard, event_id) != NULL) {
     fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+    pthread_mutex_unlock(&shard->mutex);
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = create_event(event_id, num_rows, num_cols);
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+    pthread_mutex_unlock(&shard->mutex);
     return 1;
   }
+  init_free_runs(event);
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  if (insert_event(event_list, shard, event) != 0) {
+    fprintf(stderr, "Error appending event to list\n");
+    pthread_mutex_unlock(&shard->mutex);
+    free_event(event);
     return 1;
   }
-  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
 
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  pthread_mutex_unlock(&shard->mutex);
+  atomic_fetch_add_explicit(&list_version, 1, memory_order_release);
+  return 0;
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event->data);
-    free(event);
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  size_t seats[MAX_RESERVATION_SIZE];
+  if (get_seat_indexes(event, num_seats, xs, ys, seats) != 0) return 1;
+
+  unsigned int reservation_id;
+  if (reserve_seats(event, num_seats, seats, &reservation_id)) {
+    fprintf(stderr, "Seat already reserved\n");
+    return 1;
+  }
+
+  publish_reservation(event, reservation_id, num_seats, seats);
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t* row, size_t* col) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE || num_seats > event->cols) {
+    fprintf(stderr, "Invalid number of seats\n");
+    return 1;
+  }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  size_t seats[MAX_RESERVATION_SIZE];
+  unsigned int reservation_id;
+  for (size_t r = 0; r < event->rows; r++) {
+    // Rows without a long enough run are skipped by reading the root of their free-run tree.
+    // Another reservation may take the run first, in which case the row is searched again once it updated the tree
+    size_t c;
+    while (find_free_run(event, r, num_seats, &c)) {
+      for (size_t i = 0; i < num_seats; i++) seats[i] = r * event->cols + c + i;
+      if (reserve_seats(event, num_seats, seats, &reservation_id)) {
+        sched_yield();
+        continue;
+      }
+
+      publish_reservation(event, reservation_id, num_seats, seats);
+      *row = r + 1;
+      *col = c + 1;
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "Not enough adjacent free seats\n");
+  return 1;
+}
+
+/// Copies the seats of an event for the holders of a SHOW flight.
+/// @param event_id Id of the event to copy.
+/// @param event Event to copy if it was already looked up, NULL otherwise.
+/// @param flight Flight opened by the caller.
+/// @return Copy of the seats with one reference per holder, NULL on failure.
+static SeatSnapshot_t* copy_event(unsigned int event_id, struct Event* event, Flight_t* flight) {
+  if (event == NULL) event = get_event_with_delay(event_id);
+  close_flight(flight);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
-    return 1;
+    return NULL;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
-    return 1;
+  SeatSnapshot_t* snapshot = malloc(sizeof(SeatSnapshot_t) + event->rows * event->cols * sizeof(unsigned int));
+  if (snapshot == NULL) {
+    fprintf(stderr, "Error allocating memory for event data\n");
+    return NULL;
   }
 
-  for (size_t i = 0; i < num_seats; i++) {
-    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
-      fprintf(stderr, "Seat out of bounds\n");
-      pthread_mutex_unlock(&event->mutex);
-      return 1;
-    }
+  // Only the copy is sent to the clients, so slow clients never hold up reservations
+  atomic_init(&snapshot->refs, 1);
+  atomic_init(&snapshot->runs, NULL);
+  snapshot->version = atomic_load_explicit(&event->version, memory_order_acquire);
+  snapshot->num_matrix[0] = event->rows;
+  snapshot->num_matrix[1] = event->cols;
+  snapshot_seats(event, snapshot->seats);
+  return snapshot;
+}
+
+/// Gets a copy of the seats of an event, shared with the other SHOWs of the event waiting for one.
+/// @param event_id Id of the event to copy.
+/// @param event Event to copy if it was already looked up, NULL otherwise.
+/// @param snapshot Pointer to store the copy in.
+/// @return 0 if the event was copied successfully, 1 otherwise.
+static int share_snapshot(unsigned int event_id, struct Event* event, SeatSnapshot_t** snapshot) {
+  Flight_t own;
+  int leader;
+
+  Flight_t* flight = join_flight(FLIGHT_SHOW, event_id, &own, &leader);
+  if (!leader) {
+    await_flight(flight, &event, snapshot);
+    return *snapshot == NULL;
   }
 
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    for (size_t j = 0; j < num_seats; j++) {
-      if (seat_index(event, xs[j], ys[j]) != i) {
-        continue;
-      }
+  *snapshot = copy_event(event_id, event, flight);
+  flight->snapshot = *snapshot;
+  land_flight(flight);
 
-      if (event->data[i] != 0) {
-        fprintf(stderr, "Seat already reserved\n");
-        pthread_mutex_unlock(&event->mutex);
-        return 1;
-      }
+  return *snapshot == NULL;
+}
 
-      break;
-    }
+int ems_show(unsigned int event_id, SeatSnapshot_t** snapshot) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
   }
 
-  unsigned int reservation_id = ++event->reservations;
+  return share_snapshot(event_id, NULL, snapshot);
+}
 
-  for (size_t i = 0; i < num_seats; i++) {
-    event->data[seat_index(event, xs[i], ys[i])] = reservation_id;
+int ems_show_range(unsigned int event_id, const size_t rows[2], const size_t cols[2], SeatSnapshot_t** snapshot) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
   }
 
-  pthread_mutex_unlock(&event->mutex);
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (rows[0] < 1 || rows[0] > rows[1] || rows[1] > event->rows || cols[0] < 1 || cols[0] > cols[1] ||
+      cols[1] > event->cols) {
+    fprintf(stderr, "Range out of bounds\n");
+    return 1;
+  }
+
+  size_t num_rows = rows[1] - rows[0] + 1, num_cols = cols[1] - cols[0] + 1;
+  *snapshot = malloc(sizeof(SeatSnapshot_t) + num_rows * num_cols * sizeof(unsigned int));
+  if (*snapshot == NULL) {
+    fprintf(stderr, "Error allocating memory for event data\n");
+    return 1;
+  }
+
+  atomic_init(&(*snapshot)->refs, 1);
+  atomic_init(&(*snapshot)->runs, NULL);
+  (*snapshot)->version = atomic_load_explicit(&event->version, memory_order_acquire);
+  (*snapshot)->num_matrix[0] = num_rows;
+  (*snapshot)->num_matrix[1] = num_cols;
+  RangeCopy_t copy = {.rows = rows, .cols = cols, .seats = (*snapshot)->seats};
+  read_seats(event, copy_range, &copy);
   return 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
+int ems_show_if_changed(unsigned int event_id, unsigned int known_version, SeatSnapshot_t** snapshot,
+                        unsigned int* version) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  // Most polls find the event as they left it, and nothing is copied for them
+  if (atomic_load_explicit(&event->version, memory_order_acquire) == known_version) {
+    *snapshot = NULL;
+    *version = known_version;
+    return 0;
+  }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  if (share_snapshot(event_id, event, snapshot)) return 1;
+
+  *version = (*snapshot)->version;
+  return 0;
+}
+
+int ems_show_since(unsigned int event_id, unsigned int since, SeatChanges_t* changes) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event* event = get_event_with_delay(event_id);
 
-  size_t event_size[2] = {0, 0};
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
-    if (safe_write(out_fd, &event_size, 2 * sizeof(size_t)) < 0) perror("Error writing to file descriptor");
     return 1;
   }
 
-  event_size[0] = event->rows; 
-  event_size[1] = event->cols;
-  if (safe_write(out_fd, &event_size, 2 * sizeof(size_t)) < 0) {
-    perror("Error writing to file descriptor");
+  if (event->rows * event->cols > UINT32_MAX) {
+    fprintf(stderr, "Event too large for a delta\n");
     return 1;
   }
 
-  if (safe_write(out_fd, event->data, event->rows * event->cols * sizeof(int)) < 0) {
-    perror("Error writing to file descriptor");
+  changes->pairs = NULL;
+  ChangeCollector_t collector = {.since = since, .changes = changes};
+  read_seats(event, collect_changes, &collector);
+  if (collector.failed) {
+    fprintf(stderr, "Error allocating memory for event data\n");
+    free(changes->pairs);
+    changes->pairs = NULL;
     return 1;
   }
 
+  changes->num_matrix[0] = event->rows;
+  changes->num_matrix[1] = event->cols;
   return 0;
 }
 
-int ems_list_events(int out_fd) {
+int ems_stats(unsigned int event_id, int per_row, EventStats_t* stats) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
     return 1;
   }
 
-  if (safe_write(out_fd, &event_list->event_num, sizeof(size_t)) < 0) {
-    perror("Error writing to file descriptor");
-    pthread_rwlock_unlock(&event_list->rwl);
+  if (event->rows * event->cols > UINT32_MAX) {
+    fprintf(stderr, "Event too large for statistics\n");
     return 1;
   }
 
-  if (event_list->event_num == 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 0;
+  stats->num_matrix[0] = event->rows;
+  stats->num_matrix[1] = event->cols;
+  stats->reservations = atomic_load_explicit(&event->reservations, memory_order_relaxed);
+  stats->reserved = (uint32_t)atomic_load_explicit(&event->reserved, memory_order_relaxed);
+  stats->row_reserved = NULL;
+  if (!per_row) return 0;
+
+  stats->row_reserved = malloc(event->rows * sizeof(uint32_t));
+  if (stats->row_reserved == NULL) {
+    fprintf(stderr, "Error allocating memory for statistics\n");
+    return 1;
   }
+  for (size_t row = 0; row < event->rows; row++)
+    stats->row_reserved[row] = (uint32_t)atomic_load_explicit(&event->row_reserved[row], memory_order_relaxed);
+  return 0;
+}
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
+int ems_watch(unsigned int event_id, Watcher_t* watcher) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
 
-  while (1) {
-    if (safe_write(out_fd, &(current->event)->id, sizeof(int)) < 0) {
-      perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
-      return 1;
-    }
+  struct Event* event = get_event_with_delay(event_id);
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
 
-    if (current == to) break;
+  watcher->event_id = event_id;
+  watcher->event = event;
+  pthread_mutex_lock(&event->watchers_lock);
+  watcher->next = atomic_load_explicit(&event->watchers, memory_order_relaxed);
+  atomic_store_explicit(&event->watchers, watcher, memory_order_release);
+  pthread_mutex_unlock(&event->watchers_lock);
+  return 0;
+}
+
+void ems_unwatch(Watcher_t* watcher) {
+  struct Event* event = watcher->event;
 
+  pthread_mutex_lock(&event->watchers_lock);
+  Watcher_t* previous = NULL;
+  Watcher_t* current = atomic_load_explicit(&event->watchers, memory_order_relaxed);
+  while (current != NULL && current != watcher) {
+    previous = current;
     current = current->next;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  if (current != NULL && previous != NULL)
+    previous->next = current->next;
+  else if (current != NULL)
+    atomic_store_explicit(&event->watchers, current->next, memory_order_relaxed);
+  pthread_mutex_unlock(&event->watchers_lock);
+}
+
+const SeatRuns_t* ems_snapshot_runs(SeatSnapshot_t* snapshot) {
+  SeatRuns_t* runs = atomic_load_explicit(&snapshot->runs, memory_order_acquire);
+  if (runs != NULL) return runs == &incompressible_runs ? NULL : runs;
+
+  size_t num_seats = snapshot->num_matrix[0] * snapshot->num_matrix[1];
+  size_t count = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (i == 0 || snapshot->seats[i] != snapshot->seats[i - 1]) count++;
+  }
+
+  // Runs are twice the size of a seat, so they are only sent if there are less than half as many
+  if ((2 * count >= num_seats && num_seats > 0) || num_seats > UINT32_MAX) {
+    runs = &incompressible_runs;
+  } else {
+    runs = malloc(sizeof(SeatRuns_t) + 2 * count * sizeof(uint32_t));
+    if (runs == NULL) {
+      fprintf(stderr, "Error allocating memory for seat runs\n");
+      return NULL;
+    }
+
+    runs->count = 0;
+    for (size_t i = 0; i < num_seats; i++) {
+      if (i == 0 || snapshot->seats[i] != snapshot->seats[i - 1]) {
+        runs->runs[2 * runs->count] = 0;
+        runs->runs[2 * runs->count + 1] = snapshot->seats[i];
+        runs->count++;
+      }
+      runs->runs[2 * (runs->count - 1)]++;
+    }
+  }
+
+  // Holders may compute them at the same time, the first one to finish wins
+  SeatRuns_t* computed = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&snapshot->runs, &computed, runs, memory_order_acq_rel,
+                                               memory_order_acquire)) {
+    if (runs != &incompressible_runs) free(runs);
+    runs = computed;
+  }
+  return runs == &incompressible_runs ? NULL : runs;
+}
+
+void ems_release_snapshot(SeatSnapshot_t* snapshot) {
+  if (snapshot == NULL || atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) != 1) return;
+
+  SeatRuns_t* runs = atomic_load_explicit(&snapshot->runs, memory_order_relaxed);
+  if (runs != &incompressible_runs) free(runs);
+  free(snapshot);
+}
+
+int ems_list_events(size_t* num_events, unsigned int** ids) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  size_t event_num;
+  struct ListNode* current = list_head(event_list, &event_num);
+
+  *ids = malloc(event_num * sizeof(unsigned int));
+  if (*ids == NULL && event_num > 0) {
+    fprintf(stderr, "Error allocating memory for event ids\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < event_num; i++, current = list_next(current)) (*ids)[i] = current->event->id;
+
+  *num_events = event_num;
   return 0;
 }
 
-int ems_sigusr1_action() {
+int ems_list_events_if_changed(unsigned int known_version, size_t* num_events, unsigned int** ids,
+                               unsigned int* version) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  // Read before the list, so the ids are at least as recent as the version
+  *version = atomic_load_explicit(&list_version, memory_order_acquire);
+  if (*version == known_version) {
+    *num_events = 0;
+    *ids = NULL;
+    return 0;
+  }
+
+  return ems_list_events(num_events, ids);
+}
+
+int ems_sigusr1_action() {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
+  size_t event_num;
+  struct ListNode* current = list_head(event_list, &event_num);
   struct Event* curr_event;
 
-  if (current == NULL) {
+  if (event_num == 0) {
     printf("No events\n");
-    pthread_rwlock_unlock(&event_list->rwl);
     return 0;
   }
 
-  while (1) {
+  for (size_t n = 0; n < event_num; n++, current = list_next(current)) {
     curr_event = current->event;
 
-    if (pthread_mutex_lock(&curr_event->mutex) != 0) {
-      fprintf(stderr, "Error locking mutex\n");
+    unsigned int* seats = malloc(curr_event->rows * curr_event->cols * sizeof(unsigned int));
+    if (seats == NULL) {
+      fprintf(stderr, "Error allocating memory for event data\n");
       return 1;
     }
+    snapshot_seats(curr_event, seats);
 
     printf("Event: %u\n", curr_event->id);
     for (size_t i = 1; i <= curr_event->rows; i++) {
       for (size_t j = 1; j <= curr_event->cols; j++) {
-        printf("%u", curr_event->data[seat_index(curr_event, i, j)]);
+        printf("%u", seats[seat_index(curr_event, i, j)]);
 
         if (j < curr_event->cols) printf(" ");
       }
       printf("\n");
     }
-    pthread_mutex_unlock(&curr_event->mutex);
-
-    if (current == to) break;
-
-    current = current->next;
+    free(seats);
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
   return 0;
-}
\ No newline at end of file
+}
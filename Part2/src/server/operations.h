@@ -1,12 +1,64 @@
 #ifndef SERVER_OPERATIONS_H
 #define SERVER_OPERATIONS_H
 
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/// Strategies to apply a reservation to an event.
+enum ReserveMode {
+  RESERVE_MUTEX,   // Reservations on the same event serialize on the event's mutex
+  RESERVE_CAS,     // Seats are claimed one by one with compare-and-swap, without locking
+  RESERVE_COMBINE  // Reservations are posted to the event and applied in batches by one thread at a time
+};
+
+/// Seats of a copy as runs of consecutive seats with the same reservation id, laid out as they are sent.
+typedef struct SeatRuns {
+  uint32_t count;   // Number of runs
+  uint32_t runs[];  // Length and reservation id of each run, row by row
+} SeatRuns_t;
+
+/// Copy of the seats of an event. SHOWs of the same event that run at the same time share one copy.
+typedef struct SeatSnapshot {
+  atomic_size_t refs;          // Holders of the copy. Freed when the last one releases it
+  unsigned int version;        // Version of the event the copy is at least as recent as
+  _Atomic(SeatRuns_t *) runs;  // Runs of the seats, computed by the first holder that needs them
+  size_t num_matrix[2];        // Number of rows and columns of the event
+  unsigned int seats[];        // Reservation id of each seat, row by row
+} SeatSnapshot_t;
+
+/// Seats of an event reserved after a given reservation.
+typedef struct SeatChanges {
+  unsigned int reservations;  // Every reservation with an id up to this one is accounted for
+  size_t num_matrix[2];       // Number of rows and columns of the event
+  size_t count;               // Number of seats reserved after the given reservation
+  uint32_t *pairs;            // Index and reservation id of each of those seats
+} SeatChanges_t;
+
+/// How many seats of an event are reserved.
+typedef struct EventStats {
+  size_t num_matrix[2];    // Number of rows and columns of the event
+  uint32_t reservations;   // Number of reservations of the event
+  uint32_t reserved;       // Number of seats reserved
+  uint32_t *row_reserved;  // Number of seats reserved in each row, `NULL` if they were not asked for
+} EventStats_t;
+
+/// Interest in the reservations of an event, registered with `ems_watch`. Owned by whoever registers it.
+typedef struct Watcher {
+  /// Called after each reservation of the event, by the thread that made it and with the event's watchers locked.
+  /// Must not block nor call `ems_watch` or `ems_unwatch`.
+  void (*notify)(struct Watcher *watcher, unsigned int reservation_id, size_t num_seats, const size_t *seats);
+  void *ctx;              // Free for the owner to use
+  unsigned int event_id;  // Id of the event being watched, set by `ems_watch`
+  struct Event *event;    // Event being watched, set by `ems_watch`
+  struct Watcher *next;   // Next watcher of the same event
+} Watcher_t;
 
 /// Initializes the EMS state.
 /// @param delay_us Delay in microseconds.
+/// @param mode Strategy used by `ems_reserve`.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
-int ems_init(unsigned int delay_us);
+int ems_init(unsigned int delay_us, enum ReserveMode mode);
 
 /// Destroys the EMS state.
 int ems_terminate();
@@ -26,16 +78,95 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
-/// Prints the given event.
-/// @param out_fd File descriptor to print the event to.
-/// @param event_id Id of the event to print.
-/// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int out_fd, unsigned int event_id);
+/// Reserves the first run of adjacent free seats of the given length found in a row of the given event, rows and
+/// columns in ascending order.
+/// @note Rows without such a run are skipped by their longest run of free seats, which is kept up to date by every
+/// reservation, so only rows that may have room are read.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param row Pointer to store the row of the seats reserved in.
+/// @param col Pointer to store the column of the first seat reserved in.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t *row, size_t *col);
+
+/// Copies the seats of the given event.
+/// @note Concurrent calls for the same event that arrive before the copy starts wait for it and share it.
+/// @param event_id Id of the event to copy.
+/// @param snapshot Pointer to store the copy in. Must be released with `ems_release_snapshot`.
+/// @return 0 if the event was copied successfully, 1 otherwise.
+int ems_show(unsigned int event_id, SeatSnapshot_t **snapshot);
+
+/// Copies the seats of a section of the given event.
+/// @note Only the section is read, so it costs the same however large the event is. The copy is not shared.
+/// @param event_id Id of the event to copy.
+/// @param rows First and last row of the section, starting at 1.
+/// @param cols First and last column of the section, starting at 1.
+/// @param snapshot Pointer to store the copy in, sized as the section. Must be released with `ems_release_snapshot`.
+/// @return 0 if the section was copied successfully, 1 otherwise.
+int ems_show_range(unsigned int event_id, const size_t rows[2], const size_t cols[2], SeatSnapshot_t **snapshot);
+
+/// Copies the seats of the given event, unless they did not change since the caller last saw them.
+/// @param event_id Id of the event to copy.
+/// @param known_version Version of the event last seen by the caller, 0 if none.
+/// @param snapshot Pointer to store the copy in, `NULL` if the event did not change. Must be released with
+/// `ems_release_snapshot`.
+/// @param version Pointer to store the version of the copy in, `known_version` if the event did not change.
+/// @return 0 if the event was copied or did not change, 1 otherwise.
+int ems_show_if_changed(unsigned int event_id, unsigned int known_version, SeatSnapshot_t **snapshot,
+                        unsigned int *version);
+
+/// Collects the seats of the given event reserved after the given reservation.
+/// @note Costs the same as a copy for the server, but only the reserved seats need to be sent.
+/// @param event_id Id of the event.
+/// @param since Id of the last reservation the caller knows of, 0 if none.
+/// @param changes Where to store the seats. `changes->pairs` must be freed by the caller.
+/// @return 0 if the seats were collected successfully, 1 otherwise.
+int ems_show_since(unsigned int event_id, unsigned int since, SeatChanges_t *changes);
+
+/// Gets how many seats of the given event are reserved, without reading its seats.
+/// @note The counts are kept up to date by every reservation, which may be made while they are read.
+/// @param event_id Id of the event.
+/// @param per_row Whether to also get the number of seats reserved in each row.
+/// @param stats Where to store the counts. `stats->row_reserved` must be freed by the caller.
+/// @return 0 if the counts were stored successfully, 1 otherwise.
+int ems_stats(unsigned int event_id, int per_row, EventStats_t *stats);
+
+/// Starts telling a watcher about every reservation of the given event.
+/// @note Reservations made while this call runs may or may not be notified.
+/// @param event_id Id of the event to watch.
+/// @param watcher Watcher with `notify` set. Must stay alive until it is passed to `ems_unwatch`.
+/// @return 0 if the event is being watched, 1 otherwise.
+int ems_watch(unsigned int event_id, Watcher_t *watcher);
+
+/// Stops telling a watcher about the reservations of its event. Once this returns, `notify` is no longer running.
+/// @param watcher Watcher registered with `ems_watch`.
+void ems_unwatch(Watcher_t *watcher);
+
+/// Gets the seats of a copy as runs of equal seats, which are much smaller than the seats of most events.
+/// @note Computed once per copy, however many SHOWs share it.
+/// @param snapshot Copy obtained from `ems_show`, `ems_show_range` or `ems_show_if_changed`.
+/// @return Runs of the seats, `NULL` if there are too many to be smaller than the seats or they could not be computed.
+/// Owned by the copy.
+const SeatRuns_t *ems_snapshot_runs(SeatSnapshot_t *snapshot);
+
+/// Releases a copy obtained from `ems_show`, `ems_show_range` or `ems_show_if_changed`.
+/// @param snapshot Copy to release, may be `NULL`.
+void ems_release_snapshot(SeatSnapshot_t *snapshot);
+
+/// Copies the ids of all the events.
+/// @param num_events Pointer to store the number of events in.
+/// @param ids Pointer to store the ids in. Must be freed by the caller.
+/// @return 0 if the ids were copied successfully, 1 otherwise.
+int ems_list_events(size_t *num_events, unsigned int **ids);
 
-/// Prints all the events.
-/// @param out_fd File descriptor to print the events to.
-/// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int out_fd);
+/// Copies the ids of all the events, unless no event was created since the caller last saw them.
+/// @param known_version Version of the list last seen by the caller, 0 if none.
+/// @param num_events Pointer to store the number of events in, 0 if no event was created.
+/// @param ids Pointer to store the ids in, `NULL` if no event was created. Must be freed by the caller.
+/// @param version Pointer to store the version of the ids in, `known_version` if no event was created.
+/// @return 0 if the ids were copied or no event was created, 1 otherwise.
+int ems_list_events_if_changed(unsigned int known_version, size_t *num_events, unsigned int **ids,
+                               unsigned int *version);
 
 /// Prints the status of each seat for every event to stdout
 /// @return 0 if the information was printed successfully, 1 otherwise.
@@ -42,6 +42,7 @@ void free_queue(ConnectionQueue_t *queue) {
 
   while (curr_node != NULL) {
     next_node = curr_node->next;
+    if (curr_node->socket_fd >= 0) close(curr_node->socket_fd);
     free(curr_node);
     fprintf(stderr, "\x1b[1;91m[SERVER]: Rejected Connection [Closing Server]\n");
     curr_node = next_node;
@@ -53,20 +54,15 @@ void free_queue(ConnectionQueue_t *queue) {
   pthread_cond_destroy(&queue->available_connection);
 }
 
-int enqueue_connection(ConnectionQueue_t *queue, const char *setup_buffer) {
-  Connection_t *new_connection = (Connection_t *)malloc(sizeof(Connection_t));
-  if (new_connection == NULL) {
-    fprintf(stderr, "Failed to allocate memory\n");
-    return 1;
-  }
-
+/// Adds a connection to the back of the queue and wakes up the workers.
+/// @param queue Pointer to the connection queue.
+/// @param new_connection Connection to be added.
+/// @return 0 if successfull, 1 otherwise.
+static int push_connection(ConnectionQueue_t *queue, Connection_t *new_connection) {
   new_connection->next = NULL;
-  memcpy(new_connection->req_pipe_path, setup_buffer + 1, MAX_PIPE_NAME_SIZE);
-  memcpy(new_connection->resp_pipe_path, setup_buffer + 1 + MAX_PIPE_NAME_SIZE, MAX_PIPE_NAME_SIZE);
 
   if (pthread_mutex_lock(&queue->queue_lock) != 0) {
     fprintf(stderr, "Failed locking queue");
-    free(new_connection);
     return 1;
   }
 
@@ -83,6 +79,45 @@ int enqueue_connection(ConnectionQueue_t *queue, const char *setup_buffer) {
   return 0;
 }
 
+int enqueue_connection(ConnectionQueue_t *queue, const char *setup_buffer) {
+  Connection_t *new_connection = (Connection_t *)malloc(sizeof(Connection_t));
+  if (new_connection == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return 1;
+  }
+
+  memcpy(new_connection->req_pipe_path, setup_buffer + 1, MAX_PIPE_NAME_SIZE);
+  memcpy(new_connection->resp_pipe_path, setup_buffer + 1 + MAX_PIPE_NAME_SIZE, MAX_PIPE_NAME_SIZE);
+  new_connection->socket_fd = -1;
+  new_connection->version = setup_buffer[SETUP_VERSION_OFFSET];
+
+  if (push_connection(queue, new_connection) != 0) {
+    free(new_connection);
+    return 1;
+  }
+
+  return 0;
+}
+
+int enqueue_socket_connection(ConnectionQueue_t *queue, int socket_fd) {
+  Connection_t *new_connection = (Connection_t *)malloc(sizeof(Connection_t));
+  if (new_connection == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return 1;
+  }
+
+  new_connection->req_pipe_path[0] = new_connection->resp_pipe_path[0] = '\0';
+  new_connection->socket_fd = socket_fd;
+  new_connection->version = PROTOCOL_LEGACY;  // Sent later, with the rest of the setup request
+
+  if (push_connection(queue, new_connection) != 0) {
+    free(new_connection);
+    return 1;
+  }
+
+  return 0;
+}
+
 Connection_t *dequeue_connection(ConnectionQueue_t *queue) {
   Connection_t *connection = queue->front;
 
@@ -8,6 +8,8 @@
 typedef struct Connection {
   char req_pipe_path[MAX_PIPE_NAME_SIZE];
   char resp_pipe_path[MAX_PIPE_NAME_SIZE];
+  int socket_fd;  // Accepted socket of the client, -1 if it connected through named pipes
+  char version;   // Protocol version asked for by the client
   struct Connection *next;
 } Connection_t;
 
@@ -39,6 +41,12 @@ void free_queue(ConnectionQueue_t *queue);
 /// @return 0 if successfull, 1 otherwise.
 int enqueue_connection(ConnectionQueue_t *queue, const char *setup_buffer);
 
+/// Enqueues a connection accepted on the server's socket.
+/// @param queue Pointer to the connection queue.
+/// @param socket_fd Accepted socket of the client.
+/// @return 0 if successfull, 1 otherwise.
+int enqueue_socket_connection(ConnectionQueue_t *queue, int socket_fd);
+
 /// Dequeues a connection request.
 /// @param queue Pointer to the connection queue.
 /// @return `Connection_t` struct that contains the paths of the client's named pipes
@@ -2,10 +2,17 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "common/io.h"
@@ -22,12 +29,7 @@ int check_termination(ConnectionQueue_t *queue) {
   return 0;
 }
 
-/// Listens for the client's requests, executes the appropriate commands and responds back
-/// @param req_fd File descriptor of the request pipe
-/// @param resp_fd File descriptor of the response pipe
-/// @return `CLIENT_JOB_SUCCESSS` if successful, `CLIENT_FAILED` on error,
-/// `CLIENT_UNRESPONSIVE` if the client has closed its pipes
-int handle_requests(int req_fd, int resp_fd) {
+int block_worker_signals(void) {
   sigset_t mask;
   sigemptyset(&mask);
   sigaddset(&mask, SIGPIPE);
@@ -35,180 +37,1000 @@ int handle_requests(int req_fd, int resp_fd) {
 
   if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
     fprintf(stderr, "Failed creating signal mask\n");
-    return CLIENT_FAILED;
+    return 1;
   }
+  return 0;
+}
 
-  char op = OP_NONE;
-  int response_status = 0;
-  ssize_t io_status;
+Connection_t *next_connection(ConnectionQueue_t *queue) { return wait_connection(queue, -1); }
+
+Connection_t *wait_connection(ConnectionQueue_t *queue, int timeout_ms) {
+  // The queue's condition variable waits on the realtime clock
+  struct timespec deadline;
+  if (timeout_ms >= 0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  while (1) {
+    if (check_termination(queue)) return NULL;
+
+    pthread_mutex_lock(&queue->queue_lock);
+    while (isEmpty(queue)) {
+      int wait_status = timeout_ms < 0
+                            ? pthread_cond_wait(&queue->available_connection, &queue->queue_lock)
+                            : pthread_cond_timedwait(&queue->available_connection, &queue->queue_lock, &deadline);
+
+      if (wait_status == ETIMEDOUT || check_termination(queue)) {
+        pthread_mutex_unlock(&queue->queue_lock);
+        return NULL;
+      }
+    }
+
+    Connection_t *connection = dequeue_connection(queue);
+    pthread_mutex_unlock(&queue->queue_lock);
+
+    if (connection != NULL) return connection;
+    fprintf(stderr, "Invalid connection\n");
+  }
+}
+
+/// Sends the session id to the client, followed by the protocol version of the session if the client asked for one.
+/// @param client Session being set up.
+/// @param fd File descriptor to send the reply to.
+/// @param requested_version Protocol version asked for by the client.
+/// @return Same as `safe_write`.
+static ssize_t send_setup_reply(ClientSession_t *client, int fd, char requested_version) {
+  client->version = requested_version < PROTOCOL_VERSION ? requested_version : PROTOCOL_VERSION;
+  if (client->version < PROTOCOL_LEGACY) client->version = PROTOCOL_LEGACY;
+
+  unsigned int reply[2] = {client->session_id, (unsigned int)client->version};
+  return safe_write(fd, reply, requested_version == PROTOCOL_LEGACY ? sizeof(int) : sizeof(reply));
+}
+
+/// Reads the setup request of a client connected through the server's socket, giving up on clients that do not send
+/// it within `SETUP_TIMEOUT_MS` so that they cannot hold the worker setting them up.
+/// @param socket_fd Accepted socket of the client.
+/// @param setup_buffer Buffer of `SETUP_REQUEST_BUFSIZ` bytes to store the request in.
+/// @return 0 if a whole setup request was read, 1 otherwise.
+static int read_setup_request(int socket_fd, char *setup_buffer) {
+  struct timeval timeout = {SETUP_TIMEOUT_MS / 1000, (SETUP_TIMEOUT_MS % 1000) * 1000};
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) return 1;
+
+  ssize_t read_bytes = safe_read(socket_fd, setup_buffer, SETUP_REQUEST_BUFSIZ);
+
+  // Requests are read without a timeout once the session is set up
+  struct timeval no_timeout = {0, 0};
+  if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout)) < 0) return 1;
+
+  return read_bytes != SETUP_REQUEST_BUFSIZ;
+}
+
+/// Reads the setup request of a client connected through the server's socket if all of it has arrived, without
+/// waiting for the rest.
+/// @param socket_fd Accepted socket of the client.
+/// @param setup_buffer Buffer of `SETUP_REQUEST_BUFSIZ` bytes to store the request in.
+/// @return 0 if a whole setup request was read, `CLIENT_PENDING` if it has not arrived yet, 1 otherwise.
+static int take_setup_request(int socket_fd, char *setup_buffer) {
+  ssize_t peeked = recv(socket_fd, setup_buffer, SETUP_REQUEST_BUFSIZ, MSG_PEEK | MSG_DONTWAIT);
+  if (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return CLIENT_PENDING;
+  if (peeked <= 0) return 1;
+  if (peeked < SETUP_REQUEST_BUFSIZ) return CLIENT_PENDING;
+
+  return safe_read(socket_fd, setup_buffer, SETUP_REQUEST_BUFSIZ) != SETUP_REQUEST_BUFSIZ;
+}
+
+/// Completes the setup of a client connected through the server's socket and sends it the session id.
+/// @note The socket of a nonblocking session is made nonblocking and duplicated as its response descriptor, so that
+/// pollers can wait for requests and for room for responses separately.
+/// @param client Session to be initialized.
+/// @param socket_fd Accepted socket of the client.
+/// @param nonblocking Whether nothing done on the socket may block.
+/// @return 0 if successful, `CLIENT_PENDING` if the setup request has not arrived yet, 1 otherwise.
+static int open_socket_session(ClientSession_t *client, int socket_fd, int nonblocking) {
+  char setup_buffer[SETUP_REQUEST_BUFSIZ];
+  client->req_fd = client->resp_fd = socket_fd;
+
+  int setup_status = nonblocking ? take_setup_request(socket_fd, setup_buffer)
+                                 : read_setup_request(socket_fd, setup_buffer);
+  if (setup_status == CLIENT_PENDING) return CLIENT_PENDING;
+  if (setup_status || setup_buffer[0] != OP_SETUP) {
+    fprintf(stderr, "Invalid setup request\n");
+    close(socket_fd);
+    return 1;
+  }
+
+  if (nonblocking) {
+    int flags = fcntl(socket_fd, F_GETFL);
+    if (flags < 0 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) < 0 || (client->resp_fd = dup(socket_fd)) < 0) {
+      perror("Failed to set up client socket");
+      close(socket_fd);
+      return 1;
+    }
+  }
+
+  if (send_setup_reply(client, client->resp_fd, setup_buffer[SETUP_VERSION_OFFSET]) < 0) {
+    perror("Failed to send session id to client");
+    close(socket_fd);
+    if (client->resp_fd != socket_fd) close(client->resp_fd);
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Opens the pipes of a client connected through named pipes and sends it the session id.
+/// @param client Session to be initialized.
+/// @param connection Connection request of the client.
+/// @param nonblocking Whether nothing done on the pipes may block.
+/// @return 0 if successful, `CLIENT_PENDING` if the client of a nonblocking session has not opened its response pipe
+/// yet, 1 otherwise.
+static int open_pipe_session(ClientSession_t *client, const Connection_t *connection, int nonblocking) {
+  // Opening a pipe nobody reads from fails right away instead of waiting when it does not block
+  client->resp_fd = open(connection->resp_pipe_path, nonblocking ? O_WRONLY | O_NONBLOCK : O_WRONLY);
+  if (client->resp_fd < 0 && nonblocking && errno == ENXIO) return CLIENT_PENDING;
+  if (client->resp_fd < 0) {
+    perror("Failed opening response pipe");
+    return 1;
+  }
+
+  if (send_setup_reply(client, client->resp_fd, connection->version) < 0) {
+    perror("Failed to send session id to client");
+    close(client->resp_fd);
+    return 1;
+  }
+
+  client->req_fd = open(connection->req_pipe_path, nonblocking ? O_RDONLY | O_NONBLOCK : O_RDONLY);
+  if (client->req_fd < 0) {
+    perror("Failed opening request pipe");
+    close(client->resp_fd);
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Writes as much of a buffer as the client can take right away.
+/// @note The caller must hold `send_lock`.
+/// @param client Session of the client.
+/// @param buf Buffer holding the data to write.
+/// @param nbytes Amount of data to write.
+/// @return Number of bytes written, possibly 0, -1 if the client is gone.
+static ssize_t write_available(ClientSession_t *client, const char *buf, size_t nbytes) {
+  if (client->channel != NULL) return ring_write_some(&client->channel->responses, buf, nbytes, client->req_fd);
+
+  // Responses of blocking sessions may wait for the client, so their descriptor stays blocking. Once poll reports
+  // room, a write of at most PIPE_BUF bytes does not block
+  size_t completed_bytes = 0;
+  while (completed_bytes < nbytes) {
+    struct pollfd pfd = {.fd = client->resp_fd, .events = POLLOUT, .revents = 0};
+    if (poll(&pfd, 1, 0) < 0) return -1;
+    if (pfd.revents & (POLLERR | POLLHUP)) {
+      errno = EPIPE;
+      return -1;
+    }
+    if (!(pfd.revents & POLLOUT)) break;
+
+    size_t chunk = nbytes - completed_bytes < PIPE_BUF ? nbytes - completed_bytes : PIPE_BUF;
+    ssize_t wr_bytes = write(client->resp_fd, buf + completed_bytes, chunk);
+    if (wr_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;  // Sockets may have less room than that
+    if (wr_bytes < 0) return -1;
+    completed_bytes += (size_t)wr_bytes;
+  }
+
+  return (ssize_t)completed_bytes;
+}
+
+/// Sends the pushes the client can take right away, between its responses. Sender of the session's subscriber.
+/// A push cut short is completed before anything else is sent to the client, see `write_response`.
+/// @param ctx Session of the client.
+/// @param frames Whole push frames.
+/// @param size Size of `frames`.
+/// @return Number of bytes taken from `frames`, a whole number of frames, -1 if the client is gone.
+static ssize_t send_pushes(void *ctx, const char *frames, size_t size) {
+  ClientSession_t *client = (ClientSession_t *)ctx;
+
+  // A response may be waiting for the client to read, the pushes are tried again later instead
+  if (pthread_mutex_trylock(&client->send_lock) != 0) return 0;
+  if (client->output_size > 0) {
+    pthread_mutex_unlock(&client->send_lock);
+    return 0;
+  }
+
+  ssize_t written = 0;
+  if (client->partial_size > 0) {
+    written = write_available(client, client->partial_push, client->partial_size);
+    if (written > 0) {
+      client->partial_size -= (size_t)written;
+      memmove(client->partial_push, client->partial_push + written, client->partial_size);
+    }
+  }
+
+  size_t taken = 0;
+  if (written >= 0 && client->partial_size == 0) {
+    written = write_available(client, frames, size);
+
+    // Frames are taken whole, the rest of one written in part is kept
+    while (written >= 0 && taken < (size_t)written) {
+      uint32_t length;
+      memcpy(&length, frames + taken, sizeof(uint32_t));
+      size_t frame_size = FRAME_HEADER_SIZE + length;
+
+      if (taken + frame_size > (size_t)written) {
+        client->partial_size = taken + frame_size - (size_t)written;
+        memcpy(client->partial_push, frames + written, client->partial_size);
+      }
+      taken += frame_size;
+    }
+  }
+  pthread_mutex_unlock(&client->send_lock);
+
+  return written < 0 ? -1 : (ssize_t)taken;
+}
+
+int open_session(ClientSession_t *client, const Connection_t *connection, unsigned int session_id, int nonblocking,
+                 Dispatcher_t *dispatcher, Notifier_t *notifier) {
+  client->session_id = session_id;
+  client->buffered = 0;
+  client->nonblocking = nonblocking;
+  client->channel = NULL;
+  client->dispatcher = dispatcher;
+  client->job_count = 0;
+  client->partial_size = 0;
+  client->partial_push = NULL;
+  client->output = NULL;
+  client->output_size = client->output_capacity = 0;
+
+  int open_status = connection->socket_fd >= 0 ? open_socket_session(client, connection->socket_fd, nonblocking)
+                                               : open_pipe_session(client, connection, nonblocking);
+  if (open_status) return open_status;
+
+  if (pthread_mutex_init(&client->send_lock, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize send lock\n");
+    close(client->req_fd);
+    if (client->resp_fd != client->req_fd) close(client->resp_fd);
+    return 1;
+  }
+
+  if (init_subscriber(&client->subscriber, notifier, send_pushes, client)) {
+    pthread_mutex_destroy(&client->send_lock);
+    close(client->req_fd);
+    if (client->resp_fd != client->req_fd) close(client->resp_fd);
+    return 1;
+  }
+
+  return 0;
+}
+
+void close_session(ClientSession_t *client) {
+  // Nothing is pushed once the subscriber is freed, so the pipes can be closed
+  free_subscriber(&client->subscriber);
+  pthread_mutex_destroy(&client->send_lock);
+  free(client->partial_push);
+  free(client->output);
+
+  if (client->channel != NULL) close_channel(client->channel);
+  close(client->req_fd);
+  if (client->resp_fd != client->req_fd) close(client->resp_fd);
+}
+
+/// Computes the size of a request without its frame.
+/// @param client Session the request belongs to.
+/// @param request Buffer starting with the request's operation code.
+/// @param available Number of bytes of the request already in the buffer.
+/// @return Size of the request in bytes. May be only the size of its header if the header
+/// is not complete yet, in which case it must be computed again once the header is available.
+/// `SIZE_MAX` if the header declares more seats or events than a request may hold, since where the
+/// next request starts is then unknown.
+static size_t payload_size(const ClientSession_t *client, const char *request, size_t available) {
+  switch (*request) {
+    case OP_CREATE:
+      return sizeof(char) + sizeof(int) + 2 * sizeof(size_t);
+
+    case OP_RESERVE: {
+      if (client->version < PROTOCOL_COMPACT)
+        return sizeof(char) + sizeof(int) + sizeof(size_t) + 2 * MAX_RESERVATION_SIZE * sizeof(size_t);
+
+      size_t header_size = sizeof(char) + 2 * sizeof(uint32_t);
+      if (available < header_size) return header_size;
+
+      uint32_t num_seats;
+      memcpy(&num_seats, request + sizeof(char) + sizeof(uint32_t), sizeof(uint32_t));
+      if (num_seats > MAX_RESERVATION_SIZE) return SIZE_MAX;
+
+      return header_size + 2 * num_seats * sizeof(uint32_t);
+    }
+
+    case OP_SHOW:
+      return sizeof(char) + sizeof(int);
+
+    case OP_SHOW_RANGE:
+      return sizeof(char) + 5 * sizeof(uint32_t);
+
+    case OP_SHOW_IF_CHANGED:
+    case OP_SHOW_SINCE:
+    case OP_RESERVE_BEST:
+    case OP_STATS:
+      return sizeof(char) + 2 * sizeof(uint32_t);
+
+    case OP_LIST_IF_CHANGED:
+      return sizeof(char) + sizeof(uint32_t);
+
+    case OP_WATCH: {
+      size_t header_size = sizeof(char) + sizeof(uint32_t);
+      if (available < header_size) return header_size;
+
+      uint32_t num_events;
+      memcpy(&num_events, request + sizeof(char), sizeof(uint32_t));
+      if (num_events > WATCH_MAX_EVENTS) return SIZE_MAX;
+
+      return header_size + num_events * sizeof(uint32_t);
+    }
+
+    case OP_SHM:
+      return sizeof(char) + MAX_PIPE_NAME_SIZE;
+
+    default:
+      return sizeof(char);
+  }
+}
+
+/// Computes the size of the request at the start of a buffer, including its frame.
+/// @param client Session the request belongs to.
+/// @param request Buffer starting with the request.
+/// @param available Number of bytes of the request already in the buffer.
+/// @return Same as `payload_size`, or `SIZE_MAX` if the request is malformed.
+static size_t request_size(const ClientSession_t *client, const char *request, size_t available) {
+  if (client->version < PROTOCOL_FRAMED) return payload_size(client, request, available);
+  if (available < FRAME_HEADER_SIZE) return FRAME_HEADER_SIZE;
+
+  uint32_t length;
+  memcpy(&length, request, FRAME_HEADER_SIZE);
+  size_t id_size = client->version >= PROTOCOL_TAGGED ? REQUEST_ID_SIZE : 0;
+  if (length <= id_size || length > SESSION_BUFFER_SIZE - FRAME_HEADER_SIZE) return SIZE_MAX;
+
+  // The frame must hold the whole request, or it would be decoded from whatever follows it
+  size_t header_size = FRAME_HEADER_SIZE + id_size;
+  if (available >= FRAME_HEADER_SIZE + length &&
+      payload_size(client, request + header_size, length - id_size) > length - id_size)
+    return SIZE_MAX;
+
+  return FRAME_HEADER_SIZE + length;
+}
+
+/// Writes as much of the queued responses as the client can take right away.
+/// @note The caller must hold `send_lock`.
+/// @param client Session of the client.
+/// @return Same as `write_available`.
+static ssize_t write_output(ClientSession_t *client) {
+  ssize_t written = write_available(client, client->output, client->output_size);
+  if (written > 0) {
+    client->output_size -= (size_t)written;
+    memmove(client->output, client->output + written, client->output_size);
+  }
+  return written;
+}
+
+/// Queues a response of a nonblocking session after those the client has not taken yet, then writes as much of them
+/// as the client can take right away. The rest is written by `flush_responses`.
+/// @note The caller must hold `send_lock`.
+/// @param client Session of the client.
+/// @param iov Array of buffers holding the response.
+/// @param iov_count Number of buffers in `iov`.
+/// @return Number of bytes written, possibly 0, -1 on error.
+static ssize_t queue_response(ClientSession_t *client, const struct iovec *iov, int iov_count) {
+  size_t size = client->output_size;
+  for (int i = 0; i < iov_count; i++) size += iov[i].iov_len;
+
+  if (size > client->output_capacity) {
+    size_t capacity = client->output_capacity > 0 ? client->output_capacity : SESSION_BUFFER_SIZE;
+    while (capacity < size) capacity *= 2;
+
+    char *output = (char *)realloc(client->output, capacity);
+    if (output == NULL) {
+      fprintf(stderr, "Failed to allocate memory\n");
+      return -1;
+    }
+    client->output = output;
+    client->output_capacity = capacity;
+  }
+
+  // Empty buffers, like the events of an empty LIST, may have no address
+  for (int i = 0; i < iov_count; i++) {
+    if (iov[i].iov_len == 0) continue;
+    memcpy(client->output + client->output_size, iov[i].iov_base, iov[i].iov_len);
+    client->output_size += iov[i].iov_len;
+  }
+
+  return write_output(client);
+}
+
+/// Sends a response to the client with a single write, or through shared memory if it is attached.
+/// Responses of nonblocking sessions are queued instead if the client cannot take them right away.
+/// @note The caller must hold `send_lock`.
+/// @param client Session of the client.
+/// @param status Return value of the operation, sent after the body.
+/// @param body Array of buffers holding the body of the response.
+/// @param body_count Number of buffers in `body`, at most `RESPONSE_MAX_BUFFERS`.
+/// @return 0 if successful, otherwise `CLIENT_FAILED` or `CLIENT_UNRESPONSIVE` if the client is gone.
+static int write_response(ClientSession_t *client, int status, const struct iovec *body, int body_count) {
+  struct iovec iov[RESPONSE_MAX_BUFFERS + 4];
+  int iov_count = 0;
+
+  size_t length = sizeof(int);
+  for (int i = 0; i < body_count; i++) length += body[i].iov_len;
+
+  if (client->version >= PROTOCOL_TAGGED) length += REQUEST_ID_SIZE;
 
-  while (op != OP_QUIT) {
-    if ((io_status = safe_read(req_fd, &op, sizeof(char))) <= 0) {
-      if (!io_status) return CLIENT_UNRESPONSIVE;
+  // The client would read the response as part of a push it only got in part
+  if (client->partial_size > 0) {
+    iov[iov_count++] = (struct iovec){.iov_base = client->partial_push, .iov_len = client->partial_size};
+    client->partial_size = 0;
+  }
+
+  uint32_t frame_length = (uint32_t)length;
+  if (client->version >= PROTOCOL_FRAMED) {
+    if (length > UINT32_MAX) {
+      fprintf(stderr, "Response too large\n");
       return CLIENT_FAILED;
     }
+    iov[iov_count++] = (struct iovec){.iov_base = &frame_length, .iov_len = FRAME_HEADER_SIZE};
+  }
+  if (client->version >= PROTOCOL_TAGGED)
+    iov[iov_count++] = (struct iovec){.iov_base = &client->request_id, .iov_len = REQUEST_ID_SIZE};
+  for (int i = 0; i < body_count; i++) iov[iov_count++] = body[i];
+  iov[iov_count++] = (struct iovec){.iov_base = &status, .iov_len = sizeof(int)};
+
+  ssize_t io_status = 0;
+  if (client->channel != NULL) {
+    for (int i = 0; i < iov_count && io_status >= 0; i++)
+      io_status = ring_write(&client->channel->responses, iov[i].iov_base, iov[i].iov_len, client->req_fd);
+  } else if (client->nonblocking) {
+    io_status = queue_response(client, iov, iov_count);
+  } else {
+    io_status = safe_writev(client->resp_fd, iov, iov_count);
+  }
 
-    unsigned int event_id;
-    size_t num_matrix[2], xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
-    size_t num_seats;
+  if (io_status < 0) return errno == EPIPE ? CLIENT_UNRESPONSIVE : CLIENT_FAILED;
+  return 0;
+}
 
-    switch (op) {
-      case OP_QUIT:
-        break;
+/// Sends a response to the client, see `write_response`.
+/// @param client Session of the client.
+/// @param status Return value of the operation, sent after the body.
+/// @param body Array of buffers holding the body of the response.
+/// @param body_count Number of buffers in `body`, at most `RESPONSE_MAX_BUFFERS`.
+/// @return Same as `write_response`.
+static int send_response(ClientSession_t *client, int status, const struct iovec *body, int body_count) {
+  pthread_mutex_lock(&client->send_lock);
+  int io_status = write_response(client, status, body, body_count);
+  pthread_mutex_unlock(&client->send_lock);
+  return io_status;
+}
 
-      case OP_CREATE:
-        if ((io_status = safe_read(req_fd, &event_id, sizeof(int))) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+int flush_responses(ClientSession_t *client) {
+  pthread_mutex_lock(&client->send_lock);
+  ssize_t written = write_output(client);
+  int status = client->output_size > 0 ? CLIENT_PENDING : CLIENT_SUCCESS;
+  if (written < 0) status = errno == EPIPE ? CLIENT_UNRESPONSIVE : CLIENT_FAILED;
+  pthread_mutex_unlock(&client->send_lock);
+  return status;
+}
 
-        if ((io_status = safe_read(req_fd, num_matrix, 2 * sizeof(size_t))) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+/// Maps the shared memory created by the client. Later requests and responses go through it.
+/// @note Pollers cannot wait on shared memory, so it is refused for their sessions.
+/// @param client Session of the client.
+/// @param name Name of the shared memory object, not necessarily null terminated.
+/// @return `CLIENT_PENDING` if the reply was sent, otherwise `CLIENT_FAILED` or `CLIENT_UNRESPONSIVE`.
+static int attach_channel(ClientSession_t *client, const char *name) {
+  char shm_name[MAX_PIPE_NAME_SIZE + 1] = {0};
+  memcpy(shm_name, name, MAX_PIPE_NAME_SIZE);
 
-        response_status = ems_create(event_id, num_matrix[0], num_matrix[1]);
+  SharedChannel_t *channel = NULL;
+  if (client->nonblocking || client->channel != NULL)
+    fprintf(stderr, "Shared memory is not available for this session\n");
+  else
+    channel = open_channel(shm_name);
 
-        if (safe_write(resp_fd, &response_status, sizeof(int)) < 0) {
-          if (errno == EPIPE) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+  // Answered through the pipes, the client switches to shared memory once it reads the status.
+  // No push may be sent in between, since the client would not read it from the pipes
+  pthread_mutex_lock(&client->send_lock);
+  int io_status = write_response(client, channel == NULL, NULL, 0);
+  if (io_status == 0 && channel != NULL) client->channel = channel;
+  pthread_mutex_unlock(&client->send_lock);
 
-        break;
+  if (io_status && channel != NULL) close_channel(channel);
+  return io_status ? io_status : CLIENT_PENDING;
+}
 
-      case OP_RESERVE:
-        if ((io_status = safe_read(req_fd, &event_id, sizeof(int))) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+/// Decodes a `PROTOCOL_COMPACT` reservation request.
+/// @param request Buffer holding the request, after its operation code.
+/// @param event_id Pointer to store the event id in.
+/// @param num_seats Pointer to store the number of seats in.
+/// @param xs Array of size `MAX_RESERVATION_SIZE` to store the rows in.
+/// @param ys Array of size `MAX_RESERVATION_SIZE` to store the columns in.
+static void decode_compact_reserve(const char *request, unsigned int *event_id, size_t *num_seats, size_t *xs,
+                                   size_t *ys) {
+  uint32_t header[2], seat[2];
+  memcpy(header, request, sizeof(header));
+  request += sizeof(header);
 
-        if ((io_status = safe_read(req_fd, &num_seats, sizeof(size_t))) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+  *event_id = header[0];
+  *num_seats = header[1];
+  if (*num_seats > MAX_RESERVATION_SIZE) return;  // Left for `ems_reserve` to reject
 
-        if ((io_status = safe_read(req_fd, xs, sizeof(size_t) * MAX_RESERVATION_SIZE)) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+  for (size_t i = 0; i < *num_seats; i++, request += sizeof(seat)) {
+    memcpy(seat, request, sizeof(seat));
+    xs[i] = seat[0];
+    ys[i] = seat[1];
+  }
+}
 
-        if ((io_status = safe_read(req_fd, ys, sizeof(size_t) * MAX_RESERVATION_SIZE)) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+/// Executes a request on a single event, without responding.
+/// @param client Session of the client, which is only read.
+/// @param job Request to execute, where its results are stored.
+static void run_job(const ClientSession_t *client, RequestJob_t *job) {
+  const char *request = job->request;
+  char op = *request++;
 
-        response_status = ems_reserve(event_id, num_seats, xs, ys);
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  size_t num_seats, rows[2], cols[2], row, col;
+  unsigned int known_version, since;
+  uint32_t range[4];  // Contains row_lo, row_hi, col_lo, col_hi
+  job->snapshot = NULL;
+  job->version = 0;
+  job->changes.pairs = NULL;
+  job->stats.row_reserved = NULL;
 
-        if (safe_write(resp_fd, &response_status, sizeof(int)) < 0) {
-          if (errno == EPIPE) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+  switch (op) {
+    case OP_CREATE:
+      memcpy(job->num_matrix, request + sizeof(int), 2 * sizeof(size_t));
 
+      job->status = ems_create(job->event_id, job->num_matrix[0], job->num_matrix[1]);
+      break;
+
+    case OP_RESERVE:
+      if (client->version >= PROTOCOL_COMPACT) {
+        decode_compact_reserve(request, &job->event_id, &num_seats, xs, ys);
+        job->status = ems_reserve(job->event_id, num_seats, xs, ys);
         break;
+      }
 
-      case OP_SHOW:
-        if ((io_status = safe_read(req_fd, &event_id, sizeof(int))) <= 0) {
-          if (!io_status) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+      request += sizeof(int);
+      memcpy(&num_seats, request, sizeof(size_t));
+      request += sizeof(size_t);
+      memcpy(xs, request, sizeof(size_t) * MAX_RESERVATION_SIZE);
+      request += sizeof(size_t) * MAX_RESERVATION_SIZE;
+      memcpy(ys, request, sizeof(size_t) * MAX_RESERVATION_SIZE);
 
-        response_status = ems_show(resp_fd, event_id);
+      job->status = ems_reserve(job->event_id, num_seats, xs, ys);
+      break;
 
-        if (safe_write(resp_fd, &response_status, sizeof(int)) < 0) {
-          if (errno == EPIPE) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+    case OP_RESERVE_BEST: {
+      uint32_t num_adjacent;
+      memcpy(&num_adjacent, request + sizeof(int), sizeof(uint32_t));
+      job->status = ems_reserve_best(job->event_id, num_adjacent, &row, &col);
+      if (job->status == 0) {
+        job->first_seat[0] = (uint32_t)row;
+        job->first_seat[1] = (uint32_t)col;
+      }
+      break;
+    }
 
-        break;
+    case OP_SHOW:
+      job->status = ems_show(job->event_id, &job->snapshot);
+      break;
 
-      case OP_LIST:
-        response_status = ems_list_events(resp_fd);
+    case OP_SHOW_RANGE:
+      memcpy(range, request + sizeof(int), sizeof(range));
+      rows[0] = range[0];
+      rows[1] = range[1];
+      cols[0] = range[2];
+      cols[1] = range[3];
+      job->status = ems_show_range(job->event_id, rows, cols, &job->snapshot);
+      break;
 
-        if (safe_write(resp_fd, &response_status, sizeof(int)) < 0) {
-          if (errno == EPIPE) return CLIENT_UNRESPONSIVE;
-          return CLIENT_FAILED;
-        }
+    case OP_SHOW_IF_CHANGED:
+      memcpy(&known_version, request + sizeof(int), sizeof(int));
+      job->status = ems_show_if_changed(job->event_id, known_version, &job->snapshot, &job->version);
+      break;
 
-        break;
+    case OP_SHOW_SINCE:
+      memcpy(&since, request + sizeof(int), sizeof(int));
+      job->status = ems_show_since(job->event_id, since, &job->changes);
+      break;
 
-      default:
-        break;
+    case OP_STATS: {
+      uint32_t per_row;
+      memcpy(&per_row, request + sizeof(int), sizeof(uint32_t));
+      job->status = ems_stats(job->event_id, per_row != 0, &job->stats);
+      break;
+    }
+
+    default:
+      job->status = 1;
+  }
+}
+
+/// Sends the response to a request executed by `run_job`.
+/// @param client Session of the client.
+/// @param job Executed request.
+/// @return `CLIENT_PENDING` if successful, otherwise `CLIENT_FAILED` or `CLIENT_UNRESPONSIVE`.
+static int respond_job(ClientSession_t *client, RequestJob_t *job) {
+  struct iovec body[RESPONSE_MAX_BUFFERS];
+  int body_count = 0;
+
+  // Every SHOW that shared the copy sends it from the same buffer
+  SeatSnapshot_t *snapshot = job->snapshot;
+  if (*job->request == OP_SHOW_IF_CHANGED) {
+    body[body_count++] = (struct iovec){.iov_base = &job->version, .iov_len = sizeof(int)};
+  }
+  if (*job->request == OP_SHOW || *job->request == OP_SHOW_RANGE ||
+      (*job->request == OP_SHOW_IF_CHANGED && snapshot != NULL)) {
+    static const size_t no_matrix[2] = {0, 0};
+    static const uint32_t no_runs = 0, unencoded_runs = UNENCODED_RUNS;
+    const size_t *num_matrix = snapshot != NULL ? snapshot->num_matrix : no_matrix;
+    body[body_count++] = (struct iovec){.iov_base = (void *)num_matrix, .iov_len = 2 * sizeof(size_t)};
+
+    // Runs of equal seats are sent instead of the seats when they are smaller
+    const SeatRuns_t *runs = NULL;
+    if (client->version >= PROTOCOL_RUN_LENGTH && snapshot != NULL) runs = ems_snapshot_runs(snapshot);
+    if (runs != NULL) {
+      body[body_count++] =
+          (struct iovec){.iov_base = (void *)runs, .iov_len = sizeof(SeatRuns_t) + 2 * runs->count * sizeof(uint32_t)};
+    } else if (client->version >= PROTOCOL_RUN_LENGTH) {
+      const uint32_t *count = snapshot != NULL ? &unencoded_runs : &no_runs;
+      body[body_count++] = (struct iovec){.iov_base = (void *)count, .iov_len = sizeof(uint32_t)};
+    }
+
+    if (snapshot != NULL && runs == NULL) {
+      body[body_count++] =
+          (struct iovec){.iov_base = snapshot->seats, .iov_len = num_matrix[0] * num_matrix[1] * sizeof(int)};
     }
   }
 
-  return CLIENT_SUCCESS;
+  if (*job->request == OP_RESERVE_BEST && job->status == 0) {
+    body[body_count++] = (struct iovec){.iov_base = job->first_seat, .iov_len = sizeof(job->first_seat)};
+  }
+
+  // Only the seats reserved since the known reservation are sent, instead of every seat
+  uint32_t changes_header[2] = {job->changes.reservations, (uint32_t)job->changes.count};
+  if (*job->request == OP_SHOW_SINCE && job->status == 0) {
+    body[body_count++] = (struct iovec){.iov_base = job->changes.num_matrix, .iov_len = 2 * sizeof(size_t)};
+    body[body_count++] = (struct iovec){.iov_base = changes_header, .iov_len = sizeof(changes_header)};
+    body[body_count++] =
+        (struct iovec){.iov_base = job->changes.pairs, .iov_len = 2 * job->changes.count * sizeof(uint32_t)};
+  }
+
+  // Only the counts are sent, instead of the seats they count
+  uint32_t stats_header[2] = {job->stats.reservations, job->stats.reserved};
+  if (*job->request == OP_STATS && job->status == 0) {
+    size_t num_rows = job->stats.row_reserved != NULL ? job->stats.num_matrix[0] : 0;
+    body[body_count++] = (struct iovec){.iov_base = job->stats.num_matrix, .iov_len = 2 * sizeof(size_t)};
+    body[body_count++] = (struct iovec){.iov_base = stats_header, .iov_len = sizeof(stats_header)};
+    body[body_count++] = (struct iovec){.iov_base = job->stats.row_reserved, .iov_len = num_rows * sizeof(uint32_t)};
+  }
+
+  client->request_id = job->request_id;
+  int io_status = send_response(client, job->status, body, body_count);
+  ems_release_snapshot(snapshot);
+  job->snapshot = NULL;
+  free(job->changes.pairs);
+  job->changes.pairs = NULL;
+  free(job->stats.row_reserved);
+  job->stats.row_reserved = NULL;
+  return io_status ? io_status : CLIENT_PENDING;
 }
 
-void *connect_clients(void *args) {
-  Session_t *session_info = (Session_t *)args;
-  unsigned int session_id = session_info->session_id;
-  ConnectionQueue_t *queue = session_info->queue;
+/// Gets the event a request is about, if it only touches that event.
+/// @param request Buffer holding the whole request, without its frame.
+/// @param event_id Pointer to store the event id in.
+/// @return 1 for requests on a single event, 0 for requests that must run on their own.
+static int request_event(const char *request, unsigned int *event_id) {
+  if (*request != OP_CREATE && *request != OP_RESERVE && *request != OP_SHOW && *request != OP_SHOW_IF_CHANGED &&
+      *request != OP_SHOW_SINCE && *request != OP_SHOW_RANGE && *request != OP_RESERVE_BEST && *request != OP_STATS)
+    return 0;
 
-  char req_pipe_path[MAX_PIPE_NAME_SIZE];
-  char resp_pipe_path[MAX_PIPE_NAME_SIZE];
+  // Every one of them starts with the event id, 32 bits in every protocol version
+  memcpy(event_id, request + sizeof(char), sizeof(int));
+  return 1;
+}
 
-  while (1) {
-    if (check_termination(queue)) break;
+/// Requests of a session handed to the dispatcher together.
+typedef struct RequestBatch {
+  const ClientSession_t *client;
+  size_t running;  // Number of chains of requests still running on the dispatcher
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} RequestBatch_t;
 
-    pthread_mutex_lock(&queue->queue_lock);
-    while (isEmpty(queue)) {
-      pthread_cond_wait(&queue->available_connection, &queue->queue_lock);
+/// Executes a chain of requests on the same event, in order. Dispatcher task.
+/// @param arg First request of the chain.
+static void run_chain(void *arg) {
+  RequestJob_t *job = (RequestJob_t *)arg;
+  RequestBatch_t *batch = job->batch;
 
-      if (check_termination(queue)) {
-        pthread_mutex_unlock(&queue->queue_lock);
-        return NULL;
+  for (; job != NULL; job = job->next) run_job(batch->client, job);
+
+  pthread_mutex_lock(&batch->lock);
+  if (--batch->running == 0) pthread_cond_signal(&batch->done);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+/// Executes the requests in `client->jobs`, those on different events at the same time, then responds
+/// to them in the order they were received.
+/// @param client Session of the client.
+/// @return `CLIENT_PENDING` if successful, otherwise `CLIENT_FAILED` or `CLIENT_UNRESPONSIVE`.
+static int flush_jobs(ClientSession_t *client) {
+  RequestJob_t *heads[SESSION_MAX_BATCH], *tails[SESSION_MAX_BATCH];
+  size_t chain_count = 0;
+
+  if (client->job_count == 0) return CLIENT_PENDING;
+
+  RequestBatch_t batch = {.client = client, .running = 0};
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.done, NULL);
+
+  // Chains the requests on the same event, so that they keep their order
+  for (size_t i = 0; i < client->job_count; i++) {
+    RequestJob_t *job = &client->jobs[i];
+    job->batch = &batch;
+    job->next = NULL;
+
+    size_t chain = 0;
+    while (chain < chain_count && heads[chain]->event_id != job->event_id) chain++;
+    if (chain == chain_count)
+      heads[chain_count++] = job;
+    else
+      tails[chain]->next = job;
+    tails[chain] = job;
+  }
+
+  // The session's thread runs the first chain itself instead of only waiting
+  batch.running = chain_count - 1;
+  for (size_t chain = 1; chain < chain_count; chain++) {
+    heads[chain]->task = (DispatchTask_t){.run = run_chain, .arg = heads[chain]};
+    dispatch_task(client->dispatcher, &heads[chain]->task);
+  }
+  for (RequestJob_t *job = heads[0]; job != NULL; job = job->next) run_job(client, job);
+
+  pthread_mutex_lock(&batch.lock);
+  while (batch.running > 0) pthread_cond_wait(&batch.done, &batch.lock);
+  pthread_mutex_unlock(&batch.lock);
+  pthread_cond_destroy(&batch.done);
+  pthread_mutex_destroy(&batch.lock);
+
+  int status = CLIENT_PENDING;
+  for (size_t i = 0; i < client->job_count; i++) {
+    if (status == CLIENT_PENDING) {
+      status = respond_job(client, &client->jobs[i]);
+    } else {
+      ems_release_snapshot(client->jobs[i].snapshot);
+      free(client->jobs[i].changes.pairs);
+      free(client->jobs[i].stats.row_reserved);
+    }
+  }
+
+  client->job_count = 0;
+  return status;
+}
+
+/// Executes a request and responds back
+/// @param client Session of the client
+/// @param request Buffer holding the whole request, without its frame
+/// @return `CLIENT_PENDING` if more requests may follow, `CLIENT_SUCCESS` if the client quit,
+/// `CLIENT_FAILED` on error, `CLIENT_UNRESPONSIVE` if the client has closed its pipes
+static int execute_request(ClientSession_t *client, const char *request) {
+  RequestJob_t job = {.request = request, .request_id = client->request_id};
+  if (request_event(request, &job.event_id)) {
+    run_job(client, &job);
+    return respond_job(client, &job);
+  }
+
+  char op = *request++;
+  size_t num_events;
+  unsigned int *data = NULL;
+  struct iovec body[RESPONSE_MAX_BUFFERS];
+  int body_count = 0;
+
+  switch (op) {
+    case OP_QUIT:
+      return CLIENT_SUCCESS;
+
+    case OP_LIST: {
+      int response_status = ems_list_events(&num_events, &data);
+      if (response_status) num_events = 0;
+
+      body[body_count++] = (struct iovec){.iov_base = &num_events, .iov_len = sizeof(size_t)};
+      body[body_count++] = (struct iovec){.iov_base = data, .iov_len = num_events * sizeof(int)};
+
+      int io_status = send_response(client, response_status, body, body_count);
+      free(data);
+      return io_status ? io_status : CLIENT_PENDING;
+    }
+
+    case OP_LIST_IF_CHANGED: {
+      unsigned int known_version, version = 0;
+      memcpy(&known_version, request, sizeof(int));
+      int response_status = ems_list_events_if_changed(known_version, &num_events, &data, &version);
+
+      // The events only follow the version if it changed
+      body[body_count++] = (struct iovec){.iov_base = &version, .iov_len = sizeof(int)};
+      if (response_status == 0 && version != known_version) {
+        body[body_count++] = (struct iovec){.iov_base = &num_events, .iov_len = sizeof(size_t)};
+        body[body_count++] = (struct iovec){.iov_base = data, .iov_len = num_events * sizeof(int)};
       }
+
+      int io_status = send_response(client, response_status, body, body_count);
+      free(data);
+      return io_status ? io_status : CLIENT_PENDING;
     }
 
-    Connection_t *connection = dequeue_connection(queue);
-    pthread_mutex_unlock(&queue->queue_lock);
+    case OP_SHM:
+      return attach_channel(client, request);
 
-    if (connection == NULL) {
-      fprintf(stderr, "Invalid connection\n");
-      continue;
+    case OP_WATCH: {
+      // Pushes can only be told apart from responses by their request id
+      uint32_t num_watched;
+      unsigned int event_ids[WATCH_MAX_EVENTS];
+      memcpy(&num_watched, request, sizeof(uint32_t));
+
+      int response_status = 1;
+      if (client->version < PROTOCOL_WATCH) {
+        fprintf(stderr, "Pushes are not available for this session\n");
+      } else if (num_watched > WATCH_MAX_EVENTS) {
+        fprintf(stderr, "Too many events watched\n");
+      } else if (client->partial_push == NULL && (client->partial_push = malloc(PUSH_MAX_SIZE)) == NULL) {
+        fprintf(stderr, "Failed to allocate push buffers\n");
+      } else {
+        // Nothing is pushed before the first event is watched, so `partial_push` is only needed from now on
+        memcpy(event_ids, request + sizeof(uint32_t), num_watched * sizeof(uint32_t));
+        response_status = watch_events(&client->subscriber, num_watched, event_ids);
+      }
+
+      int io_status = send_response(client, response_status, NULL, 0);
+      return io_status ? io_status : CLIENT_PENDING;
     }
 
-    memcpy(req_pipe_path, connection->req_pipe_path, MAX_PIPE_NAME_SIZE);
-    memcpy(resp_pipe_path, connection->resp_pipe_path, MAX_PIPE_NAME_SIZE);
-    free(connection);
+    default:
+      return CLIENT_PENDING;
+  }
+}
 
-    fprintf(stdout, "\x1b[1;94m[WORKER %.2u] Connected to Client!\x1b[0m\n", session_id);
+int read_requests(ClientSession_t *client) {
+  ssize_t io_status;
+  if (client->channel != NULL)
+    io_status = ring_read_some(&client->channel->requests, client->buffer + client->buffered,
+                               SESSION_BUFFER_SIZE - client->buffered, client->req_fd);
+  else
+    io_status = read(client->req_fd, client->buffer + client->buffered, SESSION_BUFFER_SIZE - client->buffered);
 
-    int resp_pipe = open(resp_pipe_path, O_WRONLY);
-    if (resp_pipe < 0) {
-      perror("Failed opening response pipe");
-      continue;
+  if (io_status < 0) {
+    if (errno == EAGAIN || errno == EINTR) return CLIENT_PENDING;
+    if (errno == ECONNRESET || errno == EPIPE) return CLIENT_UNRESPONSIVE;
+    return CLIENT_FAILED;
+  } else if (io_status == 0) {
+    return CLIENT_UNRESPONSIVE;
+  }
+  client->buffered += (size_t)io_status;
+  return CLIENT_PENDING;
+}
+
+int request_ready(const ClientSession_t *client) {
+  if (client->buffered == 0) return 0;
+
+  size_t size = request_size(client, client->buffer, client->buffered);
+  return size == SIZE_MAX || size <= client->buffered;
+}
+
+int serve_requests(ClientSession_t *client) {
+  size_t handled = 0;
+  int status = CLIENT_PENDING;
+  while (status == CLIENT_PENDING && handled < client->buffered) {
+    size_t size = request_size(client, client->buffer + handled, client->buffered - handled);
+    if (size == SIZE_MAX) {
+      fprintf(stderr, "Malformed request\n");
+      status = CLIENT_FAILED;
+      break;
     }
+    if (client->buffered - handled < size) break;
 
-    if (safe_write(resp_pipe, &session_id, sizeof(int)) < 0) {
-      perror("Failed to send session id to client");
-      close(resp_pipe);
-      continue;
+    char *request = client->buffer + handled;
+    if (client->version >= PROTOCOL_FRAMED) request += FRAME_HEADER_SIZE;
+    uint32_t request_id = 0;
+    if (client->version >= PROTOCOL_TAGGED) {
+      memcpy(&request_id, request, REQUEST_ID_SIZE);
+      request += REQUEST_ID_SIZE;
     }
 
-    int req_pipe = open(req_pipe_path, O_RDONLY);
-    if (req_pipe < 0) {
-      perror("Failed opening request pipe");
-      close(resp_pipe);
-      continue;
+    // Requests on single events wait in `jobs`, the others wait until those before them are done.
+    // Creations are not reordered either, since LIST shows the events in the order they were created
+    RequestJob_t *job = &client->jobs[client->job_count];
+    if (client->dispatcher != NULL && *request != OP_CREATE && request_event(request, &job->event_id)) {
+      job->request = request;
+      job->request_id = request_id;
+      job->snapshot = NULL;
+      job->changes.pairs = NULL;
+      job->stats.row_reserved = NULL;
+      if (++client->job_count == SESSION_MAX_BATCH) status = flush_jobs(client);
+    } else {
+      status = flush_jobs(client);
+      client->request_id = request_id;
+      if (status == CLIENT_PENDING) status = execute_request(client, request);
     }
+    handled += size;
+  }
+
+  // The requests in `jobs` point into the buffer, so they must be done before it is moved
+  if (status == CLIENT_PENDING) status = flush_jobs(client);
+  client->job_count = 0;
+
+  client->buffered -= handled;
+  memmove(client->buffer, client->buffer + handled, client->buffered);
+  return status;
+}
+
+/// Reads what is available from the request pipe and handles every complete request.
+/// @param client Session of the client.
+/// @return Same as `serve_requests`.
+static int receive_requests(ClientSession_t *client) {
+  int status = read_requests(client);
+  return status == CLIENT_PENDING ? serve_requests(client) : status;
+}
+
+/// Listens for the client's requests, executes the appropriate commands and responds back
+/// @param client Session of the client, with blocking pipes
+/// @return `CLIENT_JOB_SUCCESSS` if successful, `CLIENT_FAILED` on error,
+/// `CLIENT_UNRESPONSIVE` if the client has closed its pipes
+int handle_requests(ClientSession_t *client) {
+  int status;
+  while ((status = receive_requests(client)) == CLIENT_PENDING)
+    ;
+
+  return status;
+}
+
+void *connect_clients(void *args) {
+  Session_t *session_info = (Session_t *)args;
+  unsigned int session_id = session_info->session_id;
+  ConnectionQueue_t *queue = session_info->queue;
+
+  if (block_worker_signals()) return NULL;
+
+  ClientSession_t *client = (ClientSession_t *)malloc(sizeof(ClientSession_t));
+  if (client == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return NULL;
+  }
+
+  Connection_t *connection;
+  while ((connection = next_connection(queue)) != NULL) {
+    fprintf(stdout, "\x1b[1;94m[WORKER %.2u] Connected to Client!\x1b[0m\n", session_id);
+
+    int open_status = open_session(client, connection, session_id, 0, session_info->dispatcher, session_info->notifier);
+    free(connection);
+    if (open_status) continue;
+
+    int job_status = handle_requests(client);
+    close_session(client);
 
-    int job_status = handle_requests(req_pipe, resp_pipe);
     if (job_status) {
       if (job_status == CLIENT_FAILED)
         fprintf(stderr, "Failed communicating with client\n");
       else if (job_status == CLIENT_UNRESPONSIVE)
         fprintf(stderr, "\x1b[1;91m[WORKER %.2u] Client is unresponsive. Terminating Session...\x1b[0m\n", session_id);
 
-      close(resp_pipe);
-      close(req_pipe);
       continue;
     }
 
-    close(req_pipe);
-    close(resp_pipe);
     fprintf(stdout, "\x1b[1;94m[WORKER %.2u] Job successfully completed. Terminating Session...\x1b[0m\n", session_id);
   }
 
+  free(client);
   return NULL;
 }
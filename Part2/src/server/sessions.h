@@ -1,18 +1,137 @@
 #ifndef CONNECTIONS_H
 #define CONNECTIONS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "common/constants.h"
+#include "common/ring.h"
+#include "dispatcher.h"
+#include "notifier.h"
+#include "operations.h"
 #include "queue.h"
 
 #define CLIENT_SUCCESS 0
 #define CLIENT_FAILED 1
 #define CLIENT_UNRESPONSIVE 2
+#define CLIENT_PENDING 3
+
+#define SESSION_BUFFER_SIZE 8192  // Must fit the largest request
+#define RESPONSE_MAX_BUFFERS 4     // Maximum number of buffers in the body of a response
+#define SESSION_MAX_BATCH 64       // Maximum number of requests of a session handed to the dispatcher at once
+#define SETUP_TIMEOUT_MS 1000      // How long a client may take to get ready to be set up, see `open_session`
 
 typedef struct Session {
   ConnectionQueue_t *queue;
+  Dispatcher_t *dispatcher;  // `NULL` if requests are executed by the session's thread
+  Notifier_t *notifier;      // Pushes the reservations of watched events to the session's clients
   unsigned int session_id;
 } Session_t;
 
+struct RequestBatch;
+
+/// Request on a single event. Requests on different events run on the dispatcher at the same time,
+/// those on the same event run one after the other in the order they were received.
+typedef struct RequestJob {
+  DispatchTask_t task;
+  struct RequestBatch *batch;  // Batch the request belongs to
+  struct RequestJob *next;     // Next request of the batch on the same event
+  const char *request;         // Request without its frame, in the session's buffer
+  uint32_t request_id;
+  unsigned int event_id;
+  int status;                     // Return value of the operation
+  size_t num_matrix[2];           // Dimensions of the event, for a CREATE
+  uint32_t first_seat[2];         // Row and column of the first seat reserved, for a RESERVE_BEST
+  struct SeatSnapshot *snapshot;  // Copy of the seats, for a SHOW
+  unsigned int version;           // Version of the event, for a conditional SHOW
+  SeatChanges_t changes;          // Seats reserved since the known reservation, for a SHOW_SINCE
+  EventStats_t stats;             // Seats reserved, for a STATS
+} RequestJob_t;
+
+/// State of a connected client. Requests may arrive in pieces, so received bytes are
+/// buffered until a whole request is available.
+typedef struct ClientSession {
+  unsigned int session_id;
+  int req_fd;
+  int resp_fd;
+  int nonblocking;            // Whether the session is served by pollers, which cannot wait on a ring
+  int version;                // Protocol version spoken with the client
+  uint32_t request_id;        // Id of the request being executed, repeated in its response
+  SharedChannel_t *channel;   // Shared memory the client attached with `OP_SHM`, replacing the pipes
+  pthread_mutex_t send_lock;  // Held while sending, so responses and pushes are never interleaved
+  Subscriber_t subscriber;    // Events the client watches and the pushes waiting to be sent to it
+  size_t partial_size;        // Number of bytes in `partial_push`, protected by `send_lock`
+  char *partial_push;         // Rest of a push the client took part of, sent first. `PUSH_MAX_SIZE` bytes from WATCH on
+  char *output;               // Responses of a nonblocking session the client has not taken yet, sent before pushes
+  size_t output_size;         // Number of bytes in `output`, protected by `send_lock`
+  size_t output_capacity;     // Size of `output`
+  Dispatcher_t *dispatcher;              // Runs the requests in `jobs`, `NULL` if they are executed when received
+  size_t job_count;                      // Number of requests in `jobs`
+  RequestJob_t jobs[SESSION_MAX_BATCH];  // Requests received but not answered yet, in the order they were received
+  size_t buffered;                   // Number of bytes in `buffer`
+  char buffer[SESSION_BUFFER_SIZE];  // Bytes received but not handled yet
+} ClientSession_t;
+
+/// Blocks the signals that must only be handled by the main thread.
+/// @return 0 if successful, 1 otherwise.
+int block_worker_signals(void);
+
+/// Checks whether the server is terminating.
+/// @param queue Connection queue of the server.
+/// @return 1 if it is terminating, 0 otherwise.
+int check_termination(ConnectionQueue_t *queue);
+
+/// Waits for a connection request.
+/// @param queue Connection queue to take the request from.
+/// @return Connection request, to be freed by the caller. `NULL` if the server is terminating.
+Connection_t *next_connection(ConnectionQueue_t *queue);
+
+/// Waits for a connection request for a limited time.
+/// @param queue Connection queue to take the request from.
+/// @param timeout_ms How long to wait, negative to wait until a request arrives.
+/// @return Connection request, to be freed by the caller. `NULL` if the server is terminating or the time is up.
+Connection_t *wait_connection(ConnectionQueue_t *queue, int timeout_ms);
+
+/// Opens the client's pipes and sends it the session id.
+/// @note Nonblocking sessions never wait for the client. If it has not opened its response pipe or sent its whole
+/// setup request yet, nothing is kept and the session must be opened again later.
+/// @param client Session to be initialized.
+/// @param connection Connection request of the client.
+/// @param session_id Id of the new session.
+/// @param nonblocking Whether the session is served by pollers, so that nothing done on its pipes may block.
+/// @param dispatcher Dispatcher running independent requests at the same time, `NULL` to execute them in order.
+/// @param notifier Notifier pushing the reservations of the events the client watches.
+/// @return 0 if successful, `CLIENT_PENDING` if the client of a nonblocking session is not ready yet, 1 otherwise.
+int open_session(ClientSession_t *client, const Connection_t *connection, unsigned int session_id, int nonblocking,
+                 Dispatcher_t *dispatcher, Notifier_t *notifier);
+
+/// Stops watching the client's events, then closes its pipes and shared memory.
+/// @param client Session to be closed.
+void close_session(ClientSession_t *client);
+
+/// Reads what is available from the request pipe, without handling it.
+/// @param client Session of the client.
+/// @return `CLIENT_PENDING` if the session is still open, otherwise `CLIENT_FAILED` on error,
+/// `CLIENT_UNRESPONSIVE` if the client has closed its pipes
+int read_requests(ClientSession_t *client);
+
+/// Checks whether a whole request has been read, or one that is malformed.
+/// @param client Session of the client.
+/// @return 1 if `serve_requests` has something to handle, 0 otherwise.
+int request_ready(const ClientSession_t *client);
+
+/// Handles every complete request read so far.
+/// @param client Session of the client.
+/// @return `CLIENT_PENDING` if the session is still open, otherwise `CLIENT_SUCCESS` if the client quit,
+/// `CLIENT_FAILED` on error, `CLIENT_UNRESPONSIVE` if the client has closed its pipes
+int serve_requests(ClientSession_t *client);
+
+/// Writes as much of the responses queued by a nonblocking session as the client can take right away.
+/// @param client Session of the client.
+/// @return `CLIENT_SUCCESS` if none are left, `CLIENT_PENDING` if the client must make room for the rest first,
+/// otherwise `CLIENT_FAILED` or `CLIENT_UNRESPONSIVE` if the client is gone.
+int flush_responses(ClientSession_t *client);
+
 /// Main function that runs on the worker threads. Accepts a connection with a client
 /// and executes its commands.
 /// @param args Thread argument. A `Session_t` struct is passed as argument.